@@ -31,27 +31,69 @@ struct BITMAP256
     unsigned int colours;
     unsigned char **lines;
     unsigned char *bits;
+    unsigned int flags;
 };
 typedef struct BITMAP256 BITMAP256;
 
+/* Flags */
+#define BMP256_VIEW 1   /* lines point into another bitmap; linewidth is unpadded and bits is NULL */
+#define BMP256_POOLED 2 /* Goes back to the bitmap pool when freed */
+#define BMP256_INLINE 4 /* lines and bits are in the same block as the structure */
+
+/* Unchecked access to pixel x of a line, for a bpp known at compile time.
+** The arguments are evaluated more than once. */
+#define BMP256_SHIFT(x, bpp) ((8 - (bpp)) - ((x) * (bpp) & 7))
+#define BMP256_GETN(line, x, bpp) \
+	(((line)[(x) * (bpp) / 8] >> BMP256_SHIFT(x, bpp)) & ((1 << (bpp)) - 1))
+#define BMP256_PUTN(line, x, bpp, c) \
+	((line)[(x) * (bpp) / 8] = ((line)[(x) * (bpp) / 8] & ~(((1 << (bpp)) - 1) << BMP256_SHIFT(x, bpp))) | \
+		(((c) & ((1 << (bpp)) - 1)) << BMP256_SHIFT(x, bpp)))
+#define BMP256_GET1(line, x) BMP256_GETN(line, x, 1)
+#define BMP256_GET2(line, x) BMP256_GETN(line, x, 2)
+#define BMP256_GET4(line, x) BMP256_GETN(line, x, 4)
+#define BMP256_GET8(line, x) ((line)[x])
+#define BMP256_PUT1(line, x, c) BMP256_PUTN(line, x, 1, c)
+#define BMP256_PUT2(line, x, c) BMP256_PUTN(line, x, 2, c)
+#define BMP256_PUT4(line, x, c) BMP256_PUTN(line, x, 4, c)
+#define BMP256_PUT8(line, x, c) ((line)[x] = (c) & 0xFF)
+
+/* The same, for a bpp known at run time: pick the accessor once per bitmap
+** and walk bmp->lines[y] with it */
+typedef int (*BMP256_GETTER)(const unsigned char *line, unsigned x);
+typedef void (*BMP256_PUTTER)(unsigned char *line, unsigned x, int c);
+
 
 void bmp256_free(BITMAP256 *bmp);
 BITMAP256 *bmp256_create(int width, int height, int bpp);
+BITMAP256 *bmp256_create_ex(int width, int height, int bpp, unsigned int flags);
+void bmp256_pool_flush(void);
 BITMAP256 *bmp256_load(char *fname);
+BITMAP256 *bmp256_load_ex(char *fname, int bpp, unsigned colours);
 int bmp256_save(BITMAP256 *bmp, char *fname, int backup);
 int bmp256_setpalette (char *fname);
+void bmp256_setcompression(int rle);
+void bmp256_setlutcache(char *dir);
+int bmp256_quantize(const unsigned char *pixels, unsigned count, unsigned step, unsigned char *out, int bpp, unsigned colours);
+const unsigned char *bmp256_palette(int bpp);
 int bmp256_getpixel(BITMAP256 *bmp, int x, int y);
 int bmp256_putpixel(BITMAP256 *bmp, int x, int y, int c);
+BMP256_GETTER bmp256_getter(int bpp);
+BMP256_PUTTER bmp256_putter(int bpp);
 void bmp256_rect(BITMAP256 *bmp, int x1, int y1, int x2, int y2, int c);
 BITMAP256 *bmp256_duplicate(BITMAP256 *bmp);
+int bmp256_view(BITMAP256 *view, unsigned char **lines, BITMAP256 *parent, unsigned x, unsigned y, unsigned width, unsigned height);
 int bmp256_split(BITMAP256 *bmp, BITMAP256 **red, BITMAP256 **green, BITMAP256 **blue, BITMAP256 **bright);
 int bmp256_split_ex (BITMAP256 *bmp, BITMAP256 *planes[], unsigned planestart, unsigned planecount);
 int bmp256_split_ex2 (BITMAP256 *bmp, BITMAP256 *planes[], unsigned planestart, unsigned planecount, unsigned planebpp);
+int bmp256_split_into (BITMAP256 *bmp, BITMAP256 *planes[], unsigned planestart, unsigned planecount, unsigned planebpp);
 BITMAP256 *bmp256_merge(BITMAP256 *red, BITMAP256 *green, BITMAP256 *blue, BITMAP256 *bright);
 BITMAP256 *bmp256_merge_ex(BITMAP256 *planes[], unsigned planecount, unsigned bpp);
 void bmp256_blit(BITMAP256 *src, unsigned int srcx, unsigned int srcy, BITMAP256 *dest, unsigned int destx, unsigned int desty, unsigned int width, unsigned int height);
 void bmp256_unpack( BITMAP256 *bmp );
 BITMAP256 *bmp256_demunge(BITMAP256 *planes[], unsigned planecount, int bpp);
+BITMAP256 *bmp256_demunge_planar(const unsigned char *data, unsigned pwidth, unsigned height, unsigned planecount);
 int bmp256_munge(BITMAP256 *bmp, BITMAP256 *planes[], unsigned planecount);
+int bmp256_munge_into(BITMAP256 *bmp, BITMAP256 *planes[], unsigned planecount);
+void bmp256_munge_planar(BITMAP256 *bmp, unsigned char *data, unsigned planecount);
 
 #endif /* !INC_BMP256_H__ */
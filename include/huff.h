@@ -21,11 +21,40 @@
 #ifndef INC_HUFF_H__
 #define INC_HUFF_H__
 
+#include <stdio.h>
+#include <stdint.h>
+
+/* A Huffman dictionary together with the tables derived from it. Each
+** context is independent, so several archives can be handled at once. */
+typedef struct HuffContext HuffContext;
+
+/* Longest code the compressors can output */
+#define HUFF_MAX_CODE_BITS 64
+
+HuffContext *huff_ctx_create();
+void huff_ctx_free(HuffContext *ctx);
+void huff_ctx_expand(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen);
+void huff_ctx_expand_tree(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen);
+unsigned long huff_ctx_compress(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode);
+unsigned long huff_ctx_compress_bitwise(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode);
+int huff_ctx_read_dictionary(HuffContext *ctx, FILE *fin, unsigned long offset);
+void huff_ctx_write_dictionary(HuffContext *ctx, FILE *fout);
+int huff_ctx_huffmanize(HuffContext *ctx, int counts[]);
+int huff_ctx_huffmanize_limited(HuffContext *ctx, int counts[], int maxbits);
+int huff_ctx_setup_compression(HuffContext *ctx);
+int huff_ctx_code_length(HuffContext *ctx, int c);
+uint64_t huff_ctx_encoded_bits(HuffContext *ctx, int counts[]);
+unsigned long huff_ctx_compressed_size(HuffContext *ctx, int counts[], unsigned long inlen, int igrabhufftrailmode);
+void huff_histogram(unsigned char *data, unsigned long len, int counts[]);
+
+/* The same operations on a single process-wide dictionary */
 void huff_expand(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen);
+void huff_expand_tree(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen);
 unsigned long huff_compress(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode);
-void huff_read_dictionary(FILE *fin, unsigned long offset);
+unsigned long huff_compress_bitwise(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode);
+int huff_read_dictionary(FILE *fin, unsigned long offset);
 void huff_write_dictionary(FILE *fout);
-void huffmanize(int counts[]);
-void huff_setup_compression();
+int huffmanize(int counts[]);
+int huff_setup_compression();
 
 #endif /* !INC_HUFF_H__ */
@@ -22,6 +22,27 @@
 #ifndef INC_LZ_H__
 #define INC_LZ_H__
 
+#include <stdio.h>
+
+/* The string tables for one compression or decompression. Each context is
+** independent, so several files can be handled at once. */
+typedef struct LZContext LZContext;
+
+/* Most bytes lz_ctx_compress can output for inlen bytes of input */
+#define LZ_COMPRESS_BOUND(inlen) ((inlen) + (inlen) / 2 + 4)
+
+LZContext *lz_ctx_create( void );
+void lz_ctx_free( LZContext *ctx );
+long lz_ctx_decompress( LZContext *ctx, const unsigned char *pin, unsigned long inlen,
+    unsigned char *pout, unsigned long outlen );
+long lz_ctx_compress( LZContext *ctx, const unsigned char *pin, unsigned long inlen,
+    unsigned char *pout, unsigned long outlen );
+
+/* Decompress a little at a time, into whatever buffer suits the caller */
+void lz_ctx_stream_begin( LZContext *ctx, const unsigned char *pin, unsigned long inlen );
+long lz_ctx_stream_read( LZContext *ctx, unsigned char *pout, unsigned long outlen );
+
+/* Reference versions, reading and writing a file one bit at a time */
 long lz_decompress( FILE *fin, char *pout );
 long lz_compress( FILE *inf, FILE *outf );
 
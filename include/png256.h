@@ -0,0 +1,45 @@
+/* PNG256.H - Indexed PNG loading and saving routines - header file.
+**
+** Copyright (c)2016-2017 by Owen Pierce
+**
+** This software is provided 'as-is', without any express or implied warranty.
+** In no event will the authors be held liable for any damages arising from
+** the use of this software.
+** Permission is granted to anyone to use this software for any purpose, including
+** commercial applications, and to alter it and redistribute it freely, subject
+** to the following restrictions:
+**    1. The origin of this software must not be misrepresented; you must not
+**       claim that you wrote the original software. If you use this software in
+**       a product, an acknowledgment in the product documentation would be
+**       appreciated but is not required.
+**    2. Altered source versions must be plainly marked as such, and must not be
+**       misrepresented as being the original software.
+**    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef INC_PNG256_H__
+#define INC_PNG256_H__
+
+#include "bmp256.h"
+
+/* Returns 1 if the data starts with the PNG signature */
+int png256_signature(const unsigned char *data, unsigned long size);
+
+/* Decode a palettized PNG file held in memory. Returns NULL if it isn't one
+** that can be handled. */
+BITMAP256 *png256_decode(const unsigned char *data, unsigned long size);
+
+/* Encode a bitmap as a palettized PNG file, using the export palette.
+** Returns a malloc'd buffer, or NULL if there isn't enough memory or the
+** bitmap has no pixels, which PNG doesn't allow. */
+unsigned char *png256_encode(BITMAP256 *bmp, unsigned long *size);
+
+/* Compress data into a zlib stream. Returns a malloc'd buffer, or NULL if
+** there isn't enough memory. */
+unsigned char *png256_deflate(const unsigned char *data, unsigned long len, unsigned long *complen);
+
+/* Expand a zlib stream into out, which holds outlen bytes. Returns the
+** number of bytes written, or -1 if the stream is corrupt or too long. */
+long png256_inflate(const unsigned char *data, unsigned long len, unsigned char *out, unsigned long outlen);
+
+#endif /* !INC_PNG256_H__ */
@@ -0,0 +1,29 @@
+/* SELFTEST.H - Codec self-test and benchmark routines - header file.
+**
+** Copyright (c)2016-2017 by Owen Pierce
+**
+** This software is provided 'as-is', without any express or implied warranty.
+** In no event will the authors be held liable for any damages arising from
+** the use of this software.
+** Permission is granted to anyone to use this software for any purpose, including
+** commercial applications, and to alter it and redistribute it freely, subject
+** to the following restrictions:
+**    1. The origin of this software must not be misrepresented; you must not
+**       claim that you wrote the original software. If you use this software in
+**       a product, an acknowledgment in the product documentation would be
+**       appreciated but is not required.
+**    2. Altered source versions must be plainly marked as such, and must not be
+**       misrepresented as being the original software.
+**    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef INC_SELFTEST_H__
+#define INC_SELFTEST_H__
+
+#include "switches.h"
+
+/* Round-trip generated data through every codec, comparing the optimized
+** routines with the reference ones. Returns 1 if everything matched. */
+int selftest_run(SwitchStruct *switches);
+
+#endif /* !INC_SELFTEST_H__ */
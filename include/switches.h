@@ -30,12 +30,20 @@ typedef struct
 	int Import;
 	int Extract;
 	int SeparateMask;
+	int RleBitmaps;
 	int IgrabSig;
 	int IgrabHuffTrailMode;
 	int SparseTiles;
 	int OptimizedComp;
+	int MaxCodeLen;
+	int BestDict;
 	int Patch;
+	int Benchmark;
+	int SelfTest;
+	unsigned long SelfTestSeed;
 	char PalettePath[PATH_MAX];
+	char LutCachePath[PATH_MAX];
+	char ImageExt[4];
 	char EpisodeDefPath[PATH_MAX];
 } SwitchStruct;
 
@@ -38,6 +38,10 @@ char *strlwr (char *str);
 void completemsg();
 void showprogress(float param);
 
+/* Each -benchmark timing is the total over this many passes */
+#define BENCHMARK_PASSES 20
+void benchmark_line(const char *name, double seconds, unsigned long bytes, double reftime);
+
 /* Flag that indicates if the console output was or not initialized properly */
 extern short console_inited;
 /* Flag that indicates if we should output more info about procedures */
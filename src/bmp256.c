@@ -22,14 +22,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <memory.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "utils.h"
 #include "bmp256.h"
+#include "png256.h"
+
+#ifndef stricmp
+#define stricmp strcasecmp
+#endif /* !stricmp */
 
 #define BMP_SIG   ((uint16_t)(0x4D42))
 #define BI_RGB    0
+#define BI_RLE8   1
+#define BI_RLE4   2
+#define BI_BITFIELDS 3
+
+/* A few bytes of RLE data can describe any size of bitmap, so cap it well
+** above the largest graphic a game holds */
+#define BMP_RLE_MAX_PIXELS 0x1000000UL
+
+/* Tables kept per bpp are indexed by log2(bpp) */
+#define BPP_INDEX(bpp) ((bpp) == 1 ? 0 : (bpp) == 2 ? 1 : (bpp) == 4 ? 2 : 3)
 
 typedef struct __attribute__ ((__packed__)) BITMAPFILEHEADER {
 	uint16_t bfType; /* Must be 0x4D42 = "BM" (spec) */
@@ -112,22 +134,455 @@ RGBQUAD Palette256[256] ={
 #endif
 };
 
+/* Bitmaps created with BMP256_POOLED go back to a pool when freed, and
+ * later ones of the same size class reuse them. Exports and imports make
+ * several short-lived plane bitmaps per graphic, so this saves most of
+ * their mallocs. Size classes are powers of two; bigger bitmaps are never
+ * pooled, and each class keeps only a few. */
+#define POOL_MIN_SHIFT 6
+#define POOL_CLASSES 13
+#define POOL_DEPTH 8
+static BITMAP256 *Pool[POOL_CLASSES][POOL_DEPTH];
+static int PoolCount[POOL_CLASSES];
+
+/* Return the pool size class for a block, or -1 if it is too big */
+static int bmp256_pool_class(unsigned long size) {
+	int cls = 0;
+
+	while (cls < POOL_CLASSES && size > (1UL << (cls + POOL_MIN_SHIFT)))
+		cls++;
+	return (cls < POOL_CLASSES) ? cls : -1;
+}
+
+/* Size of the single block holding a bitmap, its line table and pixels */
+static unsigned long bmp256_block_size(unsigned long linewidth, unsigned height, unsigned long *bitsoff) {
+	/* Keep the pixels 16-byte aligned for the row kernels */
+	*bitsoff = (sizeof (BITMAP256) + height * sizeof (uint8_t *) + 15) & ~15UL;
+	return *bitsoff + linewidth * height;
+}
+
+/* Free every bitmap kept in the pool */
+void bmp256_pool_flush(void) {
+	int cls;
+
+	for (cls = 0; cls < POOL_CLASSES; cls++) {
+		while (PoolCount[cls] > 0)
+			free(Pool[cls][--PoolCount[cls]]);
+	}
+}
+
 void bmp256_free(BITMAP256 *bmp) {
-	if (bmp) {
+	unsigned long bitsoff;
+	int cls;
+
+	/* Views belong to whoever made them */
+	if (!bmp || (bmp->flags & BMP256_VIEW))
+		return;
+
+	if (!(bmp->flags & BMP256_INLINE)) {
 		if (bmp->lines)
 			free(bmp->lines);
 		if (bmp->bits)
 			free(bmp->bits);
-		free(bmp);
+	} else if (bmp->flags & BMP256_POOLED) {
+		cls = bmp256_pool_class(bmp256_block_size(bmp->linewidth, bmp->height, &bitsoff));
+		if (PoolCount[cls] < POOL_DEPTH) {
+			Pool[cls][PoolCount[cls]++] = bmp;
+			return;
+		}
+	}
+	free(bmp);
+}
+
+static void bmp256_read_row(const uint8_t *line, unsigned bpp, unsigned x, unsigned count, uint8_t *out);
+static void bmp256_write_row(uint8_t *line, unsigned bpp, unsigned x, unsigned count, const uint8_t *in);
+
+/* Save 4bpp and 8bpp bitmaps with BI_RLE4/BI_RLE8 compression */
+static int BmpCompress = 0;
+
+void bmp256_setcompression(int rle) {
+	BmpCompress = rle;
+}
+
+/* Decode BI_RLE4 or BI_RLE8 data into a cleared bitmap. Pixels that fall
+ * outside the bitmap are dropped, and running out of data ends the bitmap
+ * like an end-of-bitmap code does. */
+static int bmp256_decode_rle(BITMAP256 *bmp, const uint8_t *data, unsigned long len) {
+	unsigned long i, bytes;
+	unsigned x, row, n, b, k;
+	uint8_t *line;
+
+	i = 0;
+	x = row = 0;
+	while (i + 2 <= len && row < bmp->height) {
+		n = data[i++];
+		b = data[i++];
+		line = bmp->lines[bmp->height - 1 - row];
+		if (n) {
+			/* A run of n pixels; RLE4 alternates the two nibbles */
+			for (k = 0; k < n && x < bmp->width; k++, x++) {
+				if (bmp->bpp == 4)
+					BMP256_PUT4(line, x, (k & 1) ? b : b >> 4);
+				else
+					BMP256_PUT8(line, x, b);
+			}
+			x += n - k;
+		} else if (b == 0) {
+			/* End of line */
+			x = 0;
+			row++;
+		} else if (b == 1) {
+			/* End of bitmap */
+			break;
+		} else if (b == 2) {
+			/* Move right and up */
+			if (i + 2 > len)
+				return 0;
+			x += data[i];
+			row += data[i + 1];
+			i += 2;
+		} else {
+			/* b literal pixels, padded to a whole word */
+			bytes = (bmp->bpp == 4) ? (b + 1) / 2 : b;
+			if (i + bytes > len)
+				return 0;
+			for (k = 0; k < b && x < bmp->width; k++, x++) {
+				if (bmp->bpp == 4)
+					BMP256_PUT4(line, x, BMP256_GET4(data + i, k));
+				else
+					BMP256_PUT8(line, x, data[i + k]);
+			}
+			x += b - k;
+			i += (bytes + 1) & ~1;
+		}
+	}
+	return 1;
+}
+
+/* How many of the next left pixels (at most max) repeat p[0], or for RLE4
+ * the pair p[0], p[1] */
+static unsigned bmp256_rle_run(const uint8_t *p, unsigned left, unsigned period, unsigned max) {
+	unsigned k;
+
+	for (k = 1; k < left && k < max && p[k] == p[k % period]; k++)
+		;
+	return k;
+}
+
+/* Encode a bitmap as BI_RLE4 or BI_RLE8 data. The output needs room for
+ * 2 * width + 2 bytes per line, plus 2. Returns the length written. */
+static unsigned long bmp256_encode_rle(BITMAP256 *bmp, uint8_t *out, uint8_t *row) {
+	unsigned period, minrun, breakrun;
+	unsigned x, y, n, run, k;
+	uint8_t *o = out;
+
+	/* An RLE4 run costs 2 bytes however long it is, and literal pixels
+	 * only half a byte each, so it needs longer runs to pay off */
+	period = (bmp->bpp == 4) ? 2 : 1;
+	minrun = (bmp->bpp == 4) ? 4 : 2;
+	breakrun = (bmp->bpp == 4) ? 6 : 3;
+
+	for (y = bmp->height; y-- > 0; ) {
+		bmp256_read_row(bmp->lines[y], bmp->bpp, 0, bmp->width, row);
+		x = 0;
+		while (x < bmp->width) {
+			run = bmp256_rle_run(row + x, bmp->width - x, period, 255);
+			if (run < minrun) {
+				/* Gather literal pixels up to the next worthwhile run */
+				for (n = 1; x + n < bmp->width && n < 255; n++)
+					if (bmp256_rle_run(row + x + n, bmp->width - x - n, period, breakrun) >= breakrun)
+						break;
+				if (n >= 3) {
+					*o++ = 0;
+					*o++ = n;
+					if (bmp->bpp == 4) {
+						for (k = 0; k < n; k += 2)
+							*o++ = row[x + k] << 4 | (k + 1 < n ? row[x + k + 1] : 0);
+						if (((n + 1) / 2) & 1)
+							*o++ = 0;
+					} else {
+						memcpy(o, row + x, n);
+						o += n;
+						if (n & 1)
+							*o++ = 0;
+					}
+					x += n;
+					continue;
+				}
+				/* Too few for a literal: send them as short runs */
+				if (run > n)
+					run = n;
+			}
+			*o++ = run;
+			*o++ = (bmp->bpp == 4) ? row[x] << 4 | row[x + (run > 1)] : row[x];
+			x += run;
+		}
+
+		/* End of line, or of the bitmap */
+		*o++ = 0;
+		*o++ = y ? 0 : 1;
+	}
+	if (!bmp->height) {
+		*o++ = 0;
+		*o++ = 1;
+	}
+	return o - out;
+}
+
+/* Truecolor pictures are mapped to the palette through a table holding the
+ * nearest entry for each colour at 6 bits per channel, so converting a
+ * pixel is one lookup. The few cells holding more than one palette colour
+ * are searched instead, so that exact palette colours never change. A table
+ * takes a while to build, so they are kept for each palette in use and
+ * saved in the cache directory, when there is one. */
+#define LUT_BITS 6
+#define LUT_SIZE (1UL << (3 * LUT_BITS))
+#define LUT_CELL(r, g, b) ((unsigned long) ((r) >> (8 - LUT_BITS)) << (2 * LUT_BITS) | \
+		(unsigned long) ((g) >> (8 - LUT_BITS)) << LUT_BITS | (unsigned long) ((b) >> (8 - LUT_BITS)))
+#define LUT_CACHED 4
+#define LUT_MAGIC "MODIDLUT"
+
+typedef struct QUANTIZER {
+	int bpp;
+	unsigned colours;
+	uint8_t rgb[256][3];    /* The palette entries it was built for */
+	unsigned unique;
+	uint8_t urgb[256][3];   /* Each distinct colour once... */
+	uint8_t uindex[256];    /* ...and the lowest entry that has it */
+	int nshared;
+	uint8_t *shared;        /* One bit per cell holding several palette colours */
+	uint8_t *lut;
+} QUANTIZER;
+
+static QUANTIZER *Quantizers[LUT_CACHED];
+static int NextQuantizer = 0;
+static char LutCacheDir[PATH_MAX - 32] = "";
+
+void bmp256_setlutcache(char *dir) {
+	strncpy(LutCacheDir, dir, sizeof (LutCacheDir) - 1);
+}
+
+static void bmp256_flush_quantizers(void) {
+	int i;
+
+	for (i = 0; i < LUT_CACHED; i++) {
+		free(Quantizers[i]);
+		Quantizers[i] = NULL;
+	}
+}
+
+/* Search the palette for the nearest colour; ties go to the lowest entry */
+static int bmp256_nearest(QUANTIZER *q, int r, int g, int b) {
+	unsigned i, best = 0;
+	long d, bestd = 0x7FFFFFFF;
+
+	for (i = 0; i < q->unique; i++) {
+		d = (long) (r - q->urgb[i][0]) * (r - q->urgb[i][0]) +
+				(long) (g - q->urgb[i][1]) * (g - q->urgb[i][1]) +
+				(long) (b - q->urgb[i][2]) * (b - q->urgb[i][2]);
+		if (d < bestd) {
+			bestd = d;
+			best = i;
+		}
+	}
+	return q->uindex[best];
+}
+
+/* Find the distinct colours, and the cells that hold more than one */
+static void bmp256_quantizer_colours(QUANTIZER *q) {
+	unsigned long cell;
+	unsigned i, j;
+
+	q->unique = 0;
+	for (i = 0; i < q->colours; i++) {
+		for (j = 0; j < q->unique; j++)
+			if (!memcmp(q->urgb[j], q->rgb[i], 3))
+				break;
+		if (j == q->unique) {
+			memcpy(q->urgb[j], q->rgb[i], 3);
+			q->uindex[j] = i;
+			q->unique++;
+		}
+	}
+
+	memset(q->shared, 0, LUT_SIZE / 8);
+	q->nshared = 0;
+	for (i = 0; i < q->unique; i++) {
+		cell = LUT_CELL(q->urgb[i][0], q->urgb[i][1], q->urgb[i][2]);
+		for (j = 0; j < i; j++) {
+			if (LUT_CELL(q->urgb[j][0], q->urgb[j][1], q->urgb[j][2]) == cell) {
+				q->shared[cell >> 3] |= 1 << (cell & 7);
+				q->nshared++;
+				break;
+			}
+		}
+	}
+}
+
+/* Map the centre of each cell to its nearest colour. Distances are worked
+ * out at twice the scale, so that the centres fall on whole numbers. */
+static void bmp256_build_lut(QUANTIZER *q) {
+	long dr[256], drg[256], d, bestd;
+	unsigned r, g, b, i, best;
+	int c;
+	uint8_t *out = q->lut;
+
+	for (r = 0; r < (1 << LUT_BITS); r++) {
+		for (i = 0; i < q->unique; i++) {
+			c = (int) (r << (9 - LUT_BITS)) + (1 << (8 - LUT_BITS)) - 1 - 2 * q->urgb[i][0];
+			dr[i] = (long) c * c;
+		}
+		for (g = 0; g < (1 << LUT_BITS); g++) {
+			for (i = 0; i < q->unique; i++) {
+				c = (int) (g << (9 - LUT_BITS)) + (1 << (8 - LUT_BITS)) - 1 - 2 * q->urgb[i][1];
+				drg[i] = dr[i] + (long) c * c;
+			}
+			for (b = 0; b < (1 << LUT_BITS); b++) {
+				best = 0;
+				bestd = 0x7FFFFFFF;
+				for (i = 0; i < q->unique; i++) {
+					c = (int) (b << (9 - LUT_BITS)) + (1 << (8 - LUT_BITS)) - 1 - 2 * q->urgb[i][2];
+					d = drg[i] + (long) c * c;
+					if (d < bestd) {
+						bestd = d;
+						best = i;
+					}
+				}
+				*out++ = q->uindex[best];
+			}
+		}
 	}
+
+	/* A palette colour always maps to itself */
+	for (i = 0; i < q->unique; i++)
+		q->lut[LUT_CELL(q->urgb[i][0], q->urgb[i][1], q->urgb[i][2])] = q->uindex[i];
+}
+
+/* Cache files are named after a hash of the palette, and hold the palette
+ * too so that a clash is never mistaken for a match */
+static void bmp256_lut_filename(QUANTIZER *q, char *fname) {
+	uint32_t hash = 2166136261u;
+	unsigned i;
+
+	hash = (hash ^ (q->colours - 1)) * 16777619u;
+	for (i = 0; i < q->colours * 3; i++)
+		hash = (hash ^ q->rgb[i / 3][i % 3]) * 16777619u;
+	snprintf(fname, PATH_MAX, "%s/modid_%08lx.lut", LutCacheDir, (unsigned long) hash);
+}
+
+static int bmp256_load_lut(QUANTIZER *q) {
+	char fname[PATH_MAX];
+	uint8_t head[sizeof (LUT_MAGIC) + 256 * 3];
+	unsigned long i;
+	FILE *fin;
+	int ok;
+
+	bmp256_lut_filename(q, fname);
+	fin = fopen(fname, "rb");
+	if (!fin)
+		return 0;
+	ok = fread(head, sizeof (LUT_MAGIC) + q->colours * 3, 1, fin) == 1 &&
+			!memcmp(head, LUT_MAGIC, sizeof (LUT_MAGIC) - 1) &&
+			head[sizeof (LUT_MAGIC) - 1] == q->colours - 1 &&
+			!memcmp(head + sizeof (LUT_MAGIC), q->rgb, q->colours * 3) &&
+			fread(q->lut, LUT_SIZE, 1, fin) == 1 && fgetc(fin) == EOF;
+	fclose(fin);
+	for (i = 0; ok && i < LUT_SIZE; i++)
+		ok = q->lut[i] < q->colours;
+	return ok;
+}
+
+static void bmp256_save_lut(QUANTIZER *q) {
+	char fname[PATH_MAX];
+	uint8_t count = q->colours - 1;
+	FILE *fout;
+
+	bmp256_lut_filename(q, fname);
+	fout = fopen(fname, "wb");
+	if (!fout)
+		return;
+	fwrite(LUT_MAGIC, sizeof (LUT_MAGIC) - 1, 1, fout);
+	fwrite(&count, 1, 1, fout);
+	fwrite(q->rgb, q->colours * 3, 1, fout);
+	fwrite(q->lut, LUT_SIZE, 1, fout);
+	fclose(fout);
+}
+
+/* Get the table for the first colours entries of the palette for a bpp.
+ * The palettes only change through bmp256_setpalette, which drops them. */
+static QUANTIZER *bmp256_quantizer(int bpp, unsigned colours) {
+	const uint8_t *pal;
+	QUANTIZER *q;
+	unsigned i;
+
+	for (i = 0; i < LUT_CACHED; i++) {
+		q = Quantizers[i];
+		if (q && q->bpp == bpp && q->colours == colours)
+			return q;
+	}
+
+	/* Not made yet, so load or build one */
+	q = (QUANTIZER *) malloc(sizeof (QUANTIZER) + LUT_SIZE / 8 + LUT_SIZE);
+	if (!q)
+		return NULL;
+	q->bpp = bpp;
+	q->colours = colours;
+	pal = bmp256_palette(bpp);
+	for (i = 0; i < colours; i++) {
+		q->rgb[i][0] = pal[i * 4 + 2];
+		q->rgb[i][1] = pal[i * 4 + 1];
+		q->rgb[i][2] = pal[i * 4];
+	}
+	q->shared = (uint8_t *) (q + 1);
+	q->lut = q->shared + LUT_SIZE / 8;
+	bmp256_quantizer_colours(q);
+	if (!*LutCacheDir || !bmp256_load_lut(q)) {
+		bmp256_build_lut(q);
+		if (*LutCacheDir)
+			bmp256_save_lut(q);
+	}
+
+	free(Quantizers[NextQuantizer]);
+	Quantizers[NextQuantizer] = q;
+	NextQuantizer = (NextQuantizer + 1) % LUT_CACHED;
+	return q;
+}
+
+int bmp256_quantize(const unsigned char *pixels, unsigned count, unsigned step,
+		unsigned char *out, int bpp, unsigned colours) {
+	QUANTIZER *q;
+	unsigned long cell;
+	unsigned i;
+
+	q = bmp256_quantizer(bpp, colours);
+	if (!q)
+		return 0;
+	for (i = 0; i < count; i++, pixels += step) {
+		cell = LUT_CELL(pixels[2], pixels[1], pixels[0]);
+		if (q->nshared && (q->shared[cell >> 3] >> (cell & 7) & 1))
+			out[i] = bmp256_nearest(q, pixels[2], pixels[1], pixels[0]);
+		else
+			out[i] = q->lut[cell];
+	}
+	return 1;
 }
 
 BITMAP256 *bmp256_load(char *fname) {
-	BITMAPFILEHEADER bfh;
-	BITMAPINFOHEADER bih;
+	return bmp256_load_ex(fname, 8, 256);
+}
+
+/* Load a BMP or PNG file. Truecolor BMPs are mapped to the first colours
+ * entries of the palette, in a bitmap of the given bpp. */
+BITMAP256 *bmp256_load_ex(char *fname, int bpp, unsigned colours) {
+	BITMAPFILEHEADER *bfh;
+	BITMAPINFOHEADER *bih;
 	BITMAP256 *bmp;
 	FILE *fin;
-	int y;
+	uint8_t *buf, *row;
+	uint32_t masks[3];
+	long size;
+	unsigned long linewidth;
+	int y, truecolor;
 
 	/* Open the input picture */
 	fin = fopen(fname, "rb");
@@ -135,77 +590,143 @@ BITMAP256 *bmp256_load(char *fname) {
 		return NULL;
 	}
 
-	/* Read the header and make sure it's a real BMP */
-	fread(&bfh, sizeof (BITMAPFILEHEADER), 1, fin);
-	if (bfh.bfType != BMP_SIG) {
+	/* Read the whole file at once */
+	fseek(fin, 0, SEEK_END);
+	size = ftell(fin);
+	fseek(fin, 0, SEEK_SET);
+	if (size < (long) (sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER))) {
 		fclose(fin);
 		return NULL;
 	}
-
-	/* Make sure it's a format we can handle */
-	fread(&bih, sizeof (BITMAPINFOHEADER), 1, fin);
-	if (bih.biPlanes != 1 ||
-			(bih.biBitCount != 8 && bih.biBitCount != 4 &&
-			 bih.biBitCount != 2 && bih.biBitCount != 1) ||
-			bih.biCompression != BI_RGB || bih.biHeight < 0) {
+	buf = (uint8_t *) malloc(size);
+	if (!buf) {
+		fclose(fin);
+		return NULL;
+	}
+	if (fread(buf, size, 1, fin) != 1) {
+		free(buf);
 		fclose(fin);
 		return NULL;
 	}
+	fclose(fin);
+
+	/* PNG files load as well, whatever they're called */
+	if (png256_signature(buf, size)) {
+		bmp = png256_decode(buf, size);
+		free(buf);
+		return bmp;
+	}
+	bfh = (BITMAPFILEHEADER *) buf;
+	bih = (BITMAPINFOHEADER *) (buf + sizeof (BITMAPFILEHEADER));
+
+	/* 32bpp bitfields are fine as long as they're laid out like BI_RGB */
+	truecolor = bih->biBitCount == 24 || bih->biBitCount == 32;
+	if (bih->biBitCount == 32 && bih->biCompression == BI_BITFIELDS) {
+		if (size < (long) (sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER) + sizeof (masks))) {
+			free(buf);
+			return NULL;
+		}
+		memcpy(masks, buf + sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER), sizeof (masks));
+		if (masks[0] != 0xFF0000 || masks[1] != 0xFF00 || masks[2] != 0xFF) {
+			free(buf);
+			return NULL;
+		}
+		bih->biCompression = BI_RGB;
+	}
+
+	/* Make sure it's a real BMP, in a format we can handle */
+	if (bfh->bfType != BMP_SIG || bih->biSize < sizeof (BITMAPINFOHEADER) ||
+			bih->biPlanes != 1 ||
+			(bih->biBitCount != 8 && bih->biBitCount != 4 &&
+			 bih->biBitCount != 2 && bih->biBitCount != 1 && !truecolor) ||
+			!(bih->biCompression == BI_RGB ||
+			  (bih->biCompression == BI_RLE8 && bih->biBitCount == 8) ||
+			  (bih->biCompression == BI_RLE4 && bih->biBitCount == 4)) ||
+			bih->biHeight < 0 || bih->biWidth < 0) {
+		free(buf);
+		return NULL;
+	}
+
+	/* And that all of the pixel data is there */
+	linewidth = ((unsigned long) bih->biWidth * bih->biBitCount + 31) >> 3 & ~3;
+	if (bfh->bfOffBits > size || (bih->biCompression == BI_RGB &&
+			bih->biHeight && linewidth > (size - bfh->bfOffBits) / bih->biHeight) ||
+			(bih->biCompression != BI_RGB && bih->biHeight &&
+			 (unsigned long) bih->biWidth > BMP_RLE_MAX_PIXELS / bih->biHeight)) {
+		free(buf);
+		return NULL;
+	}
 
 	/* Create a memory bitmap */
-	bmp = bmp256_create(bih.biWidth, bih.biHeight, bih.biBitCount);
+	bmp = bmp256_create(bih->biWidth, bih->biHeight, truecolor ? bpp : bih->biBitCount);
 	if (!bmp) {
-		fclose(fin);
+		free(buf);
 		return NULL;
 	}
 
-	/* Now load the data into the buffer, one line at a time */
-	fseek(fin, bfh.bfOffBits, SEEK_SET);
-	for (y = bmp->height - 1; y >= 0; y--)
-		fread(bmp->lines[y], bmp->linewidth, 1, fin);
+	/* Now copy the data into the bitmap; BMP lines are stored bottom-up */
+	if (truecolor) {
+		row = (uint8_t *) malloc(bmp->width + 1);
+		for (y = 0; row && y < bmp->height; y++) {
+			if (!bmp256_quantize(buf + bfh->bfOffBits + y * linewidth, bmp->width,
+					bih->biBitCount / 8, row, bpp, colours))
+				break;
+			bmp256_write_row(bmp->lines[bmp->height - 1 - y], bpp, 0, bmp->width, row);
+		}
+		if (!row || y < bmp->height) {
+			free(row);
+			bmp256_free(bmp);
+			free(buf);
+			return NULL;
+		}
+		free(row);
+	} else if (bih->biCompression != BI_RGB) {
+		if (!bmp256_decode_rle(bmp, buf + bfh->bfOffBits, size - bfh->bfOffBits)) {
+			bmp256_free(bmp);
+			free(buf);
+			return NULL;
+		}
+	} else {
+		for (y = 0; y < bmp->height; y++)
+			memcpy(bmp->lines[bmp->height - 1 - y], buf + bfh->bfOffBits + y * linewidth, linewidth);
+	}
 
-	/* Close the input file and return the bitmap pointer */
-	fclose(fin);
+	/* Free the file data and return the bitmap pointer */
+	free(buf);
 	return bmp;
 }
 
-int bmp256_save(BITMAP256 *bmp, char *fname, int backup) {
+/* The headers and palette are the same for every bitmap of a given bpp,
+ * apart from the sizes, so they are built once per bpp and reused until
+ * the palette changes */
+#define BMP_PREFIX_MAX (sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER) + 256 * sizeof (RGBQUAD))
+static uint8_t BmpPrefix[4][BMP_PREFIX_MAX];
+static int BmpPrefixValid[4] = {0, 0, 0, 0};
+
+static void bmp256_build_prefix(unsigned bpp) {
 	BITMAPFILEHEADER bfh;
 	BITMAPINFOHEADER bih;
 	RGBQUAD *palette;
-	FILE *fout;
-	int y;
+	uint8_t *prefix = BmpPrefix[BPP_INDEX(bpp)];
 	int colors;
 
-	if (!bmp)
-		return 0;
-
-	/* Allow saving only 1bpp, 4bpp, and 8bpp bitmaps (2bpp isn't widely supported) */
-	assert((bmp->bpp == 1) || (bmp->bpp == 4) || (bmp->bpp == 8));
-
-	colors = (1 << bmp->bpp);
-
-	/* Open the output picture */
-	fout = openfile(fname, "wb", backup);
-	if (!fout) {
-		return 0;
-	}
+	colors = (1 << bpp);
 
 	/* Initialise the BITMAPFILEHEADER */
 	bfh.bfType = BMP_SIG;
-	bfh.bfSize = sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER) + colors * sizeof (RGBQUAD) + bmp->linewidth * bmp->height;
+	bfh.bfSize = 0;
 	bfh.bfReserved1 = 0;
 	bfh.bfReserved2 = 0;
 	bfh.bfOffBits = sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER) + colors * sizeof (RGBQUAD);
 
 	/* Initialise the BITMAPINFOHEADER */
 	bih.biSize = sizeof (BITMAPINFOHEADER);
-	bih.biWidth = bmp->width;
-	bih.biHeight = bmp->height;
+	bih.biWidth = 0;
+	bih.biHeight = 0;
 	bih.biPlanes = 1;
-	bih.biBitCount = bmp->bpp;
+	bih.biBitCount = bpp;
 	bih.biCompression = BI_RGB;
-	bih.biSizeImage = bmp->linewidth * bmp->height;
+	bih.biSizeImage = 0;
 	bih.biXPelsPerMeter = 0;
 	bih.biYPelsPerMeter = 0;
 	bih.biClrUsed = colors;
@@ -228,18 +749,116 @@ int bmp256_save(BITMAP256 *bmp, char *fname, int backup) {
 			break;
 	}
 
-	/* Write the headers and palette */
-	fwrite(&bfh, sizeof (BITMAPFILEHEADER), 1, fout);
-	fwrite(&bih, sizeof (BITMAPINFOHEADER), 1, fout);
-	fwrite(palette, sizeof (RGBQUAD), colors, fout);
+	memcpy(prefix, &bfh, sizeof (BITMAPFILEHEADER));
+	memcpy(prefix + sizeof (BITMAPFILEHEADER), &bih, sizeof (BITMAPINFOHEADER));
+	memcpy(prefix + sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER), palette, colors * sizeof (RGBQUAD));
+	BmpPrefixValid[BPP_INDEX(bpp)] = 1;
+}
 
-	/* Now save the data from the buffer, one line at a time */
-	for (y = bmp->height - 1; y >= 0; y--)
-		fwrite(bmp->lines[y], bmp->linewidth, 1, fout);
+/* Build a whole BMP file in memory, so it can be written at once */
+static uint8_t *bmp256_encode_bmp(BITMAP256 *bmp, unsigned long *filesize) {
+	BITMAPFILEHEADER *bfh;
+	BITMAPINFOHEADER *bih;
+	uint8_t *buf, *p, *row;
+	unsigned long offbits, size, rawsize, rlesize;
+	int y, rle;
 
-	/* Close the output file and return success */
+	/* Allow saving only 1bpp, 4bpp, and 8bpp bitmaps (2bpp isn't widely supported) */
+	assert((bmp->bpp == 1) || (bmp->bpp == 4) || (bmp->bpp == 8));
+
+	if (!BmpPrefixValid[BPP_INDEX(bmp->bpp)])
+		bmp256_build_prefix(bmp->bpp);
+	offbits = sizeof (BITMAPFILEHEADER) + sizeof (BITMAPINFOHEADER) + (1 << bmp->bpp) * sizeof (RGBQUAD);
+	rawsize = bmp->linewidth * bmp->height;
+	size = rawsize;
+	rle = BmpCompress && (bmp->bpp == 4 || bmp->bpp == 8);
+	if (rle && size < (2UL * bmp->width + 2) * bmp->height + 2)
+		size = (2UL * bmp->width + 2) * bmp->height + 2;
+	buf = (uint8_t *) malloc(offbits + size);
+	if (!buf)
+		return NULL;
+	memcpy(buf, BmpPrefix[BPP_INDEX(bmp->bpp)], offbits);
+	bfh = (BITMAPFILEHEADER *) buf;
+	bih = (BITMAPINFOHEADER *) (buf + sizeof (BITMAPFILEHEADER));
+
+	/* Compress if asked to, unless that makes the bitmap bigger */
+	rlesize = 0;
+	if (rle) {
+		row = (uint8_t *) malloc(bmp->width + 1);
+		if (!row) {
+			free(buf);
+			return NULL;
+		}
+		rlesize = bmp256_encode_rle(bmp, buf + offbits, row);
+		free(row);
+	}
+	if (rle && rlesize < rawsize) {
+		size = rlesize;
+		bih->biCompression = (bmp->bpp == 4) ? BI_RLE4 : BI_RLE8;
+	} else {
+		/* BMP lines are stored bottom-up */
+		size = rawsize;
+		p = buf + offbits;
+		for (y = bmp->height - 1; y >= 0; y--) {
+			memcpy(p, bmp->lines[y], bmp->linewidth);
+			p += bmp->linewidth;
+		}
+	}
+
+	/* Fill in the sizes */
+	bfh->bfSize = offbits + size;
+	bih->biWidth = bmp->width;
+	bih->biHeight = bmp->height;
+	bih->biSizeImage = size;
+	*filesize = offbits + size;
+	return buf;
+}
+
+/* Save a bitmap as a BMP file, or as a PNG file if the name ends in .png */
+int bmp256_save(BITMAP256 *bmp, char *fname, int backup) {
+	FILE *fout;
+	uint8_t *buf;
+	unsigned long size, len;
+	int ok;
+
+	if (!bmp)
+		return 0;
+
+	/* Views don't have padded lines */
+	assert(!(bmp->flags & BMP256_VIEW));
+
+	len = strlen(fname);
+	if (len >= 4 && !stricmp(fname + len - 4, ".png"))
+		buf = png256_encode(bmp, &size);
+	else
+		buf = bmp256_encode_bmp(bmp, &size);
+	if (!buf)
+		return 0;
+
+	/* Open the output picture */
+	fout = openfile(fname, "wb", backup);
+	if (!fout) {
+		free(buf);
+		return 0;
+	}
+
+	/* Write it, close the output file and return success */
+	ok = (fwrite(buf, size, 1, fout) == 1);
 	fclose(fout);
-	return 1;
+	free(buf);
+	return ok;
+}
+
+/* The export palette for a bpp, as blue, green, red and unused bytes */
+const unsigned char *bmp256_palette(int bpp) {
+	switch (bpp) {
+		case 1:
+			return (const unsigned char *) Palette2;
+		case 2:
+			return (const unsigned char *) Palette4;
+		default:
+			return (const unsigned char *) Palette256;
+	}
 }
 
 /* Set the global 256-color palette for exporting bitmaps */
@@ -274,50 +893,65 @@ int bmp256_setpalette(char *fname) {
 	fread(Palette256, sizeof (RGBQUAD),
 			bih.biClrUsed ? bih.biClrUsed : 1 << bih.biBitCount, fin);
 
+	/* Bitmaps saved from now on need the new palette, and truecolor ones
+	 * loaded need new tables */
+	BmpPrefixValid[BPP_INDEX(4)] = 0;
+	BmpPrefixValid[BPP_INDEX(8)] = 0;
+	bmp256_flush_quantizers();
+
 	/* Close the input file and return success */
 	fclose(fin);
 	return 1;
 }
 
 BITMAP256 *bmp256_create(int width, int height, int bpp) {
+	return bmp256_create_ex(width, height, bpp, 0);
+}
+
+/* Create a bitmap, with its line table and pixels in the same block. With
+ * BMP256_POOLED in flags, the block comes from and goes back to the pool. */
+BITMAP256 *bmp256_create_ex(int width, int height, int bpp, unsigned int flags) {
 	BITMAP256 *bmp;
+	unsigned long linewidth, size, bitsoff;
 	unsigned int y;
+	int cls = -1;
 
 	assert(width >= 0);
 	assert(height >= 0);
 
-	/* Allocate the BITMAP structure */
-	bmp = (BITMAP256 *) malloc(sizeof (BITMAP256));
-	if (!bmp) {
-		return NULL;
-	}
-	bmp->width = width;
-	bmp->height = height;
-
 	/* Allow only 1bpp, 2bpp, 4bpp, and 8bpp bitmaps */
 	assert((bpp == 1) || (bpp == 2) || (bpp == 4) || (bpp == 8));
-	bmp->bpp = bpp;
 
 	/* Calculate line width in bytes, with dword padding */
-	bmp->linewidth = (bmp->width * bmp->bpp + 31) >> 3 & ~3;
-	bmp->lines = NULL;
-	bmp->bits = NULL;
-
-	/* Allocate the pixel buffer */
-	bmp->bits = (uint8_t *) malloc(bmp->height * bmp->linewidth *
-			sizeof (uint8_t));
-	if (!bmp->bits) {
-		bmp256_free(bmp);
-		return NULL;
+	linewidth = ((unsigned long) width * bpp + 31) >> 3 & ~3;
+	size = bmp256_block_size(linewidth, height, &bitsoff);
+
+	/* Allocate the block, from the pool if we can */
+	bmp = NULL;
+	if (flags & BMP256_POOLED) {
+		cls = bmp256_pool_class(size);
+		if (cls < 0)
+			flags &= ~BMP256_POOLED;
+		else if (PoolCount[cls] > 0)
+			bmp = Pool[cls][--PoolCount[cls]];
+		else
+			size = 1UL << (cls + POOL_MIN_SHIFT);
 	}
-
-	/* Allocate the lines array */
-	bmp->lines = (uint8_t **) malloc(bmp->height *
-			sizeof (uint8_t *));
-	if (!bmp->lines) {
-		bmp256_free(bmp);
+	if (!bmp)
+		bmp = (BITMAP256 *) malloc(size);
+	if (!bmp) {
 		return NULL;
 	}
+
+	bmp->width = width;
+	bmp->height = height;
+	bmp->bpp = bpp;
+	bmp->linewidth = linewidth;
+	bmp->flags = BMP256_INLINE | (flags & BMP256_POOLED);
+
+	/* The lines array follows the structure, and the pixels follow that */
+	bmp->lines = (uint8_t **) (bmp + 1);
+	bmp->bits = (uint8_t *) bmp + bitsoff;
 	for (y = 0; y < bmp->height; y++)
 		bmp->lines[y] = bmp->bits + bmp->linewidth * y;
 
@@ -327,105 +961,143 @@ BITMAP256 *bmp256_create(int width, int height, int bpp) {
 	return bmp;
 }
 
+// Accessors for each bpp, for loops that can't use the macros directly
+#define BMP256_ACCESSORS(n) \
+	static int bmp256_get##n(const uint8_t *line, unsigned x) { return BMP256_GET##n(line, x); } \
+	static void bmp256_put##n(uint8_t *line, unsigned x, int c) { BMP256_PUT##n(line, x, c); }
+BMP256_ACCESSORS(1)
+BMP256_ACCESSORS(2)
+BMP256_ACCESSORS(4)
+BMP256_ACCESSORS(8)
+
+static int bmp256_get0(const uint8_t *line, unsigned x) { return 0; }
+static void bmp256_put0(uint8_t *line, unsigned x, int c) { }
+
+BMP256_GETTER bmp256_getter(int bpp) {
+	switch (bpp) {
+	case 1: return bmp256_get1;
+	case 2: return bmp256_get2;
+	case 4: return bmp256_get4;
+	case 8: return bmp256_get8;
+	}
+	return bmp256_get0;
+}
+
+BMP256_PUTTER bmp256_putter(int bpp) {
+	switch (bpp) {
+	case 1: return bmp256_put1;
+	case 2: return bmp256_put2;
+	case 4: return bmp256_put4;
+	case 8: return bmp256_put8;
+	}
+	return bmp256_put0;
+}
+
 int bmp256_getpixel(BITMAP256 *bmp, int x, int y) {
-	register int shift;
 	if (x < 0 || x >= bmp->width || y < 0 || y >= bmp->height)
 		return -1;
 
-	if (bmp->bpp == 1) {
-		shift = (~x & 7);
-		return (bmp->lines[y][x / 8] >> shift) & 0x01;
-	} else if (bmp->bpp == 2) {
-		shift = (~x & 3) * 2;
-		return (bmp->lines[y][x / 4] >> shift) & 0x03;
-	} else if (bmp->bpp == 4) {
-		shift = (~x & 1) * 4;
-		return (bmp->lines[y][x / 2] >> shift) & 0x0F;
-	} else if (bmp->bpp == 8) {
-		return bmp->lines[y][x] & 0xFF;
-	}
-
-	return 0;
+	return bmp256_getter(bmp->bpp)(bmp->lines[y], x);
 }
 
 int bmp256_putpixel(BITMAP256 *bmp, int x, int y, int c) {
-	register int mask, shift;
 	if (x < 0 || x >= bmp->width || y < 0 || y >= bmp->height)
 		return -1;
 
-	if (bmp->bpp == 1) {
-		shift = (~x & 7);
-		mask = 0x01 << shift;
-		bmp->lines[y][x / 8] &= ~mask;
-		bmp->lines[y][x / 8] |= ((c & 1) << shift);
-	} else if (bmp->bpp == 2) {
-		shift = (~x & 3) * 2;
-		mask = 0x03 << shift;
-		bmp->lines[y][x / 4] &= ~mask;
-		bmp->lines[y][x / 4] |= (c << shift) & mask;
-	} else if (bmp->bpp == 4) {
-		shift = (~x & 1) * 4;
-		mask = 0x0F << shift;
-		bmp->lines[y][x / 2] &= ~mask;
-		bmp->lines[y][x / 2] |= (c << shift) & mask;
-	} else if (bmp->bpp == 8) {
-		mask = 0xFF;
-		bmp->lines[y][x] = c & mask;
-	}
-
+	bmp256_putter(bmp->bpp)(bmp->lines[y], x, c);
 	return c;
 }
 
 void bmp256_rect(BITMAP256 *bmp, int x1, int y1, int x2, int y2, int c) {
-	unsigned int x, y;
+	BMP256_PUTTER put;
+	int x, y, perbyte, count, shift;
+	uint8_t fill;
 
 	/* Make some sanity checks */
 	if (x1 > x2 || y1 > y2)
 		return;
+	if (bmp->bpp != 1 && bmp->bpp != 2 && bmp->bpp != 4 && bmp->bpp != 8)
+		return;
 
 	if (x1 < 0)
 		x1 = 0;
 	if (y1 < 0)
 		y1 = 0;
 
-	if (x2 >= bmp->width)
+	if (x2 >= (int) bmp->width)
 		x2 = bmp->width - 1;
 
-	if (y2 >= bmp->height)
+	if (y2 >= (int) bmp->height)
 		y2 = bmp->height - 1;
 
-	/* Color pixel by pixel */
-	for (y = y1; y <= y2; y++)
-		for (x = x1; x <= x2; x++)
-			bmp256_putpixel(bmp, x, y, c);
+	/* Repeat the colour across a whole byte */
+	fill = c & ((1 << bmp->bpp) - 1);
+	for (shift = bmp->bpp; shift < 8; shift *= 2)
+		fill |= fill << shift;
+
+	/* Color the partial bytes at each end pixel by pixel, and the rest a
+	** byte at a time */
+	put = bmp256_putter(bmp->bpp);
+	perbyte = 8 / bmp->bpp;
+	for (y = y1; y <= y2; y++) {
+		for (x = x1; x <= x2 && x % perbyte; x++)
+			put(bmp->lines[y], x, c);
+		if (x <= x2) {
+			count = (x2 + 1 - x) / perbyte;
+			memset(bmp->lines[y] + x / perbyte, fill, count);
+			x += count * perbyte;
+		}
+		for (; x <= x2; x++)
+			put(bmp->lines[y], x, c);
+	}
 }
 
 BITMAP256 *bmp256_duplicate(BITMAP256 *bmp) {
 	BITMAP256 *bmp2 = bmp256_create(bmp->width, bmp->height, bmp->bpp);
+	unsigned int y;
+
 	if (bmp2) {
-		memcpy(bmp2->bits, bmp->bits, bmp->linewidth * bmp->height);
+		/* A view's lines are not next to each other */
+		if (bmp->flags & BMP256_VIEW) {
+			for (y = 0; y < bmp->height; y++)
+				memcpy(bmp2->lines[y], bmp->lines[y], bmp->linewidth);
+		} else {
+			memcpy(bmp2->bits, bmp->bits, bmp->linewidth * bmp->height);
+		}
 	}
 
 	return bmp2;
 }
 
+/* Make view refer to a rectangle of parent, without copying any pixels.
+ * lines must have room for height pointers. The rectangle has to start on
+ * a byte boundary. Returns 0 if it can't be viewed. */
+int bmp256_view(BITMAP256 *view, unsigned char **lines, BITMAP256 *parent,
+		unsigned x, unsigned y, unsigned width, unsigned height) {
+	unsigned int i;
+
+	if ((x * parent->bpp) & 7 || x + width > parent->width || y + height > parent->height)
+		return 0;
+
+	view->width = width;
+	view->height = height;
+	view->bpp = parent->bpp;
+	view->linewidth = (width * parent->bpp + 7) >> 3;
+	view->flags = BMP256_VIEW;
+	view->bits = NULL;
+	view->lines = lines;
+	for (i = 0; i < height; i++)
+		lines[i] = parent->lines[y + i] + x * parent->bpp / 8;
+
+	return 1;
+}
+
 int bmp256_split(BITMAP256 *bmp, BITMAP256 **red, BITMAP256 **green, BITMAP256 **blue, BITMAP256 **bright) {
 	if (bmp->bpp == 4) {
 		BITMAP256 * planes[4];
-		unsigned int x, y;
-		int p, c;
 
-		for (p = 0; p < 4; p++) {
-			planes[p] = bmp256_create(bmp->width, bmp->height, 1);
-
-			for (y = 0; y < bmp->height; y++) {
-				for (x = 0; x < bmp->width; x++) {
-					c = bmp256_getpixel(bmp, x, y);
-					c = (c & (1 << p)) ? 1 : 0;
-					bmp256_putpixel(planes[p], x, y, c);
-				}
-			}
-		}
+		if (!bmp256_split_ex(bmp, planes, 0, 4))
+			return 0;
 		*blue = planes[0];
 		*green = planes[1];
 		*red = planes[2];
@@ -436,6 +1108,219 @@ int bmp256_split(BITMAP256 *bmp, BITMAP256 **red, BITMAP256 **green, BITMAP256 *
 	return 0;
 }
 
+/* Row kernels for converting between chunky pixels and 1bpp planes.
+ * Each works on groups of 8 pixels, which fill one byte of every plane.
+ * SplitLut[c] holds bit p of c in byte p, so or-ing SplitLut[pixel] << (7-i)
+ * over a group gives every plane's byte at once. MergeLut8 and MergeLut4 go
+ * the other way, spreading a plane byte over 8 pixels in 8bpp or 4bpp order.
+ */
+static uint64_t SplitLut[256];
+static uint64_t MergeLut8[256];
+static uint32_t MergeLut4[256];
+static uint8_t BitReverse[256];
+static int LutsInitialised = 0;
+
+static void bmp256_init_luts(void) {
+	unsigned v, i;
+
+	if (LutsInitialised)
+		return;
+
+	for (v = 0; v < 256; v++) {
+		SplitLut[v] = 0;
+		MergeLut8[v] = 0;
+		MergeLut4[v] = 0;
+		BitReverse[v] = 0;
+		for (i = 0; i < 8; i++) {
+			if (v & (1 << i)) {
+				SplitLut[v] |= (uint64_t) 1 << (i * 8);
+				BitReverse[v] |= 0x80 >> i;
+			}
+			/* Pixel i comes from bit 7-i of the plane byte */
+			if (v & (0x80 >> i)) {
+				MergeLut8[v] |= (uint64_t) 1 << (i * 8);
+				MergeLut4[v] |= (uint32_t) 1 << ((i / 2) * 8 + ((i & 1) ? 0 : 4));
+			}
+		}
+	}
+	LutsInitialised = 1;
+}
+
+/* Split a row of 4bpp or 8bpp pixels into planecount 1bpp rows */
+static void bmp256_split_row(const uint8_t *src, unsigned srcbpp, unsigned width,
+		uint8_t *dst[], unsigned planestart, unsigned planecount) {
+	const uint8_t *s;
+	uint8_t group[8];
+	uint64_t acc;
+	unsigned x = 0, i, p;
+
+#ifdef __AVX2__
+	{
+		/* Reverse each group of 8 pixels, so that movemask puts the first
+		 * pixel of a group in the top bit of its byte */
+		const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+				7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+		__m256i v;
+		__m128i h;
+		uint32_t m;
+
+		for (; x + 32 <= width; x += 32) {
+			if (srcbpp == 8) {
+				v = _mm256_loadu_si256((const __m256i *) (src + x));
+			} else {
+				h = _mm_loadu_si128((const __m128i *) (src + x / 2));
+				v = _mm256_set_m128i(
+						_mm_unpackhi_epi8(_mm_and_si128(_mm_srli_epi16(h, 4), nibble), _mm_and_si128(h, nibble)),
+						_mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(h, 4), nibble), _mm_and_si128(h, nibble)));
+			}
+			v = _mm256_shuffle_epi8(v, reverse);
+			for (p = 0; p < planecount; p++) {
+				m = _mm256_movemask_epi8(_mm256_sll_epi16(v, _mm_cvtsi32_si128(7 - planestart - p)));
+				dst[p][x / 8] = m;
+				dst[p][x / 8 + 1] = m >> 8;
+				dst[p][x / 8 + 2] = m >> 16;
+				dst[p][x / 8 + 3] = m >> 24;
+			}
+		}
+	}
+#endif
+#ifdef __SSE2__
+	{
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+		__m128i v;
+		unsigned m;
+
+		for (; x + 16 <= width; x += 16) {
+			if (srcbpp == 8) {
+				v = _mm_loadu_si128((const __m128i *) (src + x));
+			} else {
+				v = _mm_loadl_epi64((const __m128i *) (src + x / 2));
+				v = _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(v, 4), nibble), _mm_and_si128(v, nibble));
+			}
+			/* movemask puts the first pixel in the bottom bit, so reverse the bytes */
+			for (p = 0; p < planecount; p++) {
+				m = _mm_movemask_epi8(_mm_sll_epi16(v, _mm_cvtsi32_si128(7 - planestart - p)));
+				dst[p][x / 8] = BitReverse[m & 0xFF];
+				dst[p][x / 8 + 1] = BitReverse[m >> 8];
+			}
+		}
+	}
+#endif
+	for (; x < width; x += 8) {
+		s = src + (srcbpp == 8 ? x : x / 2);
+		/* Pad the last group with zeros */
+		if (x + 8 > width) {
+			memset(group, 0, sizeof (group));
+			if (srcbpp == 8) {
+				memcpy(group, s, width - x);
+			} else {
+				memcpy(group, s, (width - x + 1) / 2);
+				if ((width - x) & 1)
+					group[(width - x) / 2] &= 0xF0;
+			}
+			s = group;
+		}
+
+		acc = 0;
+		if (srcbpp == 8) {
+			for (i = 0; i < 8; i++)
+				acc |= SplitLut[s[i]] << (7 - i);
+		} else {
+			for (i = 0; i < 4; i++)
+				acc |= SplitLut[s[i] >> 4] << (7 - i * 2) |
+					SplitLut[s[i] & 0x0F] << (6 - i * 2);
+		}
+		for (p = 0; p < planecount; p++)
+			dst[p][x / 8] = acc >> ((planestart + p) * 8);
+	}
+}
+
+/* Merge planecount 1bpp rows into a row of 4bpp or 8bpp pixels */
+static void bmp256_merge_row(uint8_t *src[], unsigned planecount, unsigned width,
+		uint8_t *dst, unsigned dstbpp) {
+	uint8_t group[8];
+	uint64_t acc;
+	uint32_t acc4;
+	unsigned x = 0, i, p, count;
+
+#ifdef __AVX2__
+	{
+		/* Copy plane byte i of the group to pixels 8i to 8i+7, then keep
+		 * the bit belonging to each pixel */
+		const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+				2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+		const __m256i bits = _mm256_set1_epi64x(0x0102040810204080LL);
+		__m256i v, acc8;
+
+		for (; x + 32 <= width; x += 32) {
+			acc8 = _mm256_setzero_si256();
+			for (p = 0; p < planecount; p++) {
+				v = _mm256_set1_epi32(src[p][x / 8] | src[p][x / 8 + 1] << 8 |
+						src[p][x / 8 + 2] << 16 | (uint32_t) src[p][x / 8 + 3] << 24);
+				v = _mm256_shuffle_epi8(v, spread);
+				v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+				acc8 = _mm256_or_si256(acc8, _mm256_and_si256(v, _mm256_set1_epi8(1 << p)));
+			}
+			if (dstbpp == 8) {
+				_mm256_storeu_si256((__m256i *) (dst + x), acc8);
+			} else {
+				v = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(acc8, _mm256_set1_epi16(0x00FF)), 4),
+						_mm256_srli_epi16(acc8, 8));
+				v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+				_mm_storeu_si128((__m128i *) (dst + x / 2), _mm256_castsi256_si128(v));
+			}
+		}
+	}
+#endif
+#ifdef __SSE2__
+	{
+		const __m128i bits = _mm_set1_epi64x(0x0102040810204080LL);
+		__m128i v, acc8;
+
+		for (; x + 16 <= width; x += 16) {
+			acc8 = _mm_setzero_si128();
+			for (p = 0; p < planecount; p++) {
+				v = _mm_cvtsi32_si128(src[p][x / 8] | src[p][x / 8 + 1] << 8);
+				v = _mm_unpacklo_epi8(v, v);
+				v = _mm_unpacklo_epi16(v, v);
+				v = _mm_unpacklo_epi32(v, v);
+				v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+				acc8 = _mm_or_si128(acc8, _mm_and_si128(v, _mm_set1_epi8(1 << p)));
+			}
+			if (dstbpp == 8) {
+				_mm_storeu_si128((__m128i *) (dst + x), acc8);
+			} else {
+				v = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(acc8, _mm_set1_epi16(0x00FF)), 4),
+						_mm_srli_epi16(acc8, 8));
+				_mm_storel_epi64((__m128i *) (dst + x / 2), _mm_packus_epi16(v, v));
+			}
+		}
+	}
+#endif
+	for (; x < width; x += 8) {
+		count = (width - x < 8) ? width - x : 8;
+		if (dstbpp == 8) {
+			acc = 0;
+			for (p = 0; p < planecount; p++)
+				acc |= MergeLut8[src[p][x / 8]] << p;
+			for (i = 0; i < count; i++)
+				group[i] = acc >> (i * 8);
+			memcpy(dst + x, group, count);
+		} else {
+			acc4 = 0;
+			for (p = 0; p < planecount; p++)
+				acc4 |= MergeLut4[src[p][x / 8]] << p;
+			/* Leave the pixels past the end of the row clear */
+			for (i = count; i < 8; i++)
+				acc4 &= ~((uint32_t) 0x0F << ((i / 2) * 8 + ((i & 1) ? 0 : 4)));
+			for (i = 0; i < 4; i++)
+				group[i] = acc4 >> (i * 8);
+			memcpy(dst + x / 2, group, (count + 1) / 2);
+		}
+	}
+}
+
 /* Split variable number of planes into 1bpp bitmaps */
 int bmp256_split_ex(BITMAP256 *bmp, BITMAP256 *planes[],
 		unsigned planestart, unsigned planecount) {
@@ -445,6 +1330,21 @@ int bmp256_split_ex(BITMAP256 *bmp, BITMAP256 *planes[],
 /* Split variable number of planes into bitmaps of variable bpp */
 int bmp256_split_ex2(BITMAP256 *bmp, BITMAP256 *planes[],
 		unsigned planestart, unsigned planecount, unsigned planebpp) {
+	int p;
+
+	assert(bmp);
+	for (p = 0; p < planecount; p++) {
+		planes[p] = bmp256_create_ex(bmp->width, bmp->height, planebpp, BMP256_POOLED);
+		if (!planes[p])
+			return 0;
+	}
+
+	return bmp256_split_into(bmp, planes, planestart, planecount, planebpp);
+}
+
+/* Split variable number of planes into existing bitmaps of the same size */
+int bmp256_split_into(BITMAP256 *bmp, BITMAP256 *planes[],
+		unsigned planestart, unsigned planecount, unsigned planebpp) {
 	unsigned int x, y;
 	int p, c, mask, shift;
 
@@ -453,14 +1353,28 @@ int bmp256_split_ex2(BITMAP256 *bmp, BITMAP256 *planes[],
 	assert(planebpp >= 1 && planebpp <= 8);
 	assert(planestart >= 0);
 	assert(planecount*planebpp + planestart <= bmp->bpp);
+	for (p = 0; p < planecount; p++) {
+		assert(planes[p] && planes[p]->bpp == planebpp &&
+				planes[p]->width == bmp->width &&
+				planes[p]->height == bmp->height);
+	}
+
+	/* Chunky pixels to 1bpp planes go a row at a time */
+	if (planebpp == 1 && (bmp->bpp == 4 || bmp->bpp == 8)) {
+		uint8_t *dst[8];
+
+		bmp256_init_luts();
+		for (y = 0; y < bmp->height; y++) {
+			for (p = 0; p < planecount; p++)
+				dst[p] = planes[p]->lines[y];
+			bmp256_split_row(bmp->lines[y], bmp->bpp, bmp->width, dst, planestart, planecount);
+		}
+		return 1;
+	}
 
 	/* Split into bitmaps */
 	mask = (1<<planebpp)-1;
 	for (p = 0; p < planecount; p++) {
-		planes[p] = bmp256_create(bmp->width, bmp->height, planebpp);
-		if (!planes[p])
-			return 0;
-
 		shift = p*planebpp + planestart;
 
 		for (y = 0; y < bmp->height; y++) {
@@ -495,11 +1409,25 @@ BITMAP256 *bmp256_merge_ex(BITMAP256 *planes[], unsigned planecount, unsigned bp
 				planes[p]->height == planes[0]->height);
 	}
 
-	bmp = bmp256_create(planes[0]->width, planes[0]->height, bpp);
+	bmp = bmp256_create_ex(planes[0]->width, planes[0]->height, bpp, BMP256_POOLED);
 	if (!bmp)
 		return NULL;
 
 	planebpp = planes[0]->bpp;
+
+	/* 1bpp planes to chunky pixels go a row at a time */
+	if (planebpp == 1 && (bpp == 4 || bpp == 8)) {
+		uint8_t *src[8];
+
+		bmp256_init_luts();
+		for (y = 0; y < bmp->height; y++) {
+			for (p = 0; p < planecount; p++)
+				src[p] = planes[p]->lines[y];
+			bmp256_merge_row(src, planecount, bmp->width, bmp->lines[y], bpp);
+		}
+		return bmp;
+	}
+
 	planebppmask = (1 << planebpp) - 1;
 	for (y = 0; y < bmp->height; y++) {
 		for (x = 0; x < bmp->width; x++) {
@@ -514,9 +1442,7 @@ BITMAP256 *bmp256_merge_ex(BITMAP256 *planes[], unsigned planecount, unsigned bp
 }
 
 BITMAP256 *bmp256_merge(BITMAP256 *red, BITMAP256 *green, BITMAP256 *blue, BITMAP256 *bright) {
-	BITMAP256 *bmp;
-	int p, c;
-	unsigned int x, y;
+	int p;
 	BITMAP256 * planes[4];
 
 	planes[0] = blue;
@@ -528,26 +1454,115 @@ BITMAP256 *bmp256_merge(BITMAP256 *red, BITMAP256 *green, BITMAP256 *blue, BITMA
 		if (!planes[p] || planes[p]->bpp != 1)
 			return NULL;
 
-	bmp = bmp256_create(planes[0]->width, planes[1]->height, 8);
-	if (!bmp)
-		return NULL;
+	return bmp256_merge_ex(planes, 4, 8);
+}
 
-	for (y = 0; y < bmp->height; y++) {
-		for (x = 0; x < bmp->width; x++) {
-			c = bmp256_getpixel(planes[0], x, y) & 1;
-			c |= (bmp256_getpixel(planes[1], x, y) & 1) << 1;
-			c |= (bmp256_getpixel(planes[2], x, y) & 1) << 2;
-			c |= (bmp256_getpixel(planes[3], x, y) & 1) << 3;
-			bmp256_putpixel(bmp, x, y, c);
+/* Pixels converted per step of a blit */
+#define BLIT_CHUNK 256
+
+/* How a pixel changes when blitted between bitmaps of different bpp */
+static int bmp256_blit_convert(int c, unsigned srcbpp, unsigned destbpp) {
+	if (srcbpp == 1 && destbpp == 2)
+		c = (c == 1 ? 3 : 0);
+	else if (srcbpp == 1 && destbpp == 4)
+		c = (c == 1 ? 15 : 0);
+	else if (srcbpp == 1 && destbpp == 8)
+		c = (c == 1 ? 15 : 0);
+
+	else if (srcbpp == 4 && destbpp == 1)
+		c = (c > 7 ? 1 : 0);
+	else if (srcbpp == 8 && destbpp == 1)
+		c = (c > 7 ? 1 : 0);
+	else if (srcbpp == 8 && destbpp == 4)
+		c = (c % 16);
+
+	return c;
+}
+
+/* The conversion for every pair of bpp, indexed by BPP_INDEX */
+static uint8_t BlitLut[4][4][256];
+static int BlitIdentity[4][4];
+static int BlitLutsInitialised = 0;
+
+static void bmp256_init_blit_luts(void) {
+	unsigned s, d;
+	int c;
+
+	if (BlitLutsInitialised)
+		return;
+
+	bmp256_init_luts();
+	for (s = 0; s < 4; s++) {
+		for (d = 0; d < 4; d++) {
+			BlitIdentity[s][d] = 1;
+			for (c = 0; c < (1 << (1 << s)); c++) {
+				BlitLut[s][d][c] = bmp256_blit_convert(c, 1 << s, 1 << d);
+				if (BlitLut[s][d][c] != c)
+					BlitIdentity[s][d] = 0;
+			}
 		}
 	}
+	BlitLutsInitialised = 1;
+}
 
-	return bmp;
+/* Read count pixels from a row, starting at x, as one byte each */
+static void bmp256_read_row(const uint8_t *line, unsigned bpp, unsigned x, unsigned count, uint8_t *out) {
+	uint64_t pix;
+	unsigned i, j, shift;
+
+	if (bpp == 8) {
+		memcpy(out, line + x, count);
+		return;
+	}
+
+	i = 0;
+	if (bpp == 1 && !(x & 7)) {
+		/* Whole bytes become 8 pixels at once */
+		for (; i + 8 <= count; i += 8) {
+			pix = MergeLut8[line[(x + i) / 8]];
+			for (j = 0; j < 8; j++)
+				out[i + j] = pix >> (j * 8);
+		}
+	} else if (bpp == 4 && !(x & 1)) {
+		for (; i + 2 <= count; i += 2) {
+			out[i] = line[(x + i) / 2] >> 4;
+			out[i + 1] = line[(x + i) / 2] & 0x0F;
+		}
+	}
+	for (; i < count; i++) {
+		shift = (8 - bpp) - ((x + i) * bpp & 7);
+		out[i] = (line[(x + i) * bpp / 8] >> shift) & ((1 << bpp) - 1);
+	}
+}
+
+/* Write count one-byte pixels into a row, starting at x */
+static void bmp256_write_row(uint8_t *line, unsigned bpp, unsigned x, unsigned count, const uint8_t *in) {
+	unsigned i, mask, shift;
+
+	if (bpp == 8) {
+		memcpy(line + x, in, count);
+		return;
+	}
+
+	i = 0;
+	if (bpp == 4 && !(x & 1)) {
+		for (; i + 2 <= count; i += 2)
+			line[(x + i) / 2] = (in[i] & 0x0F) << 4 | (in[i + 1] & 0x0F);
+	}
+	for (; i < count; i++) {
+		shift = (8 - bpp) - ((x + i) * bpp & 7);
+		mask = ((1 << bpp) - 1) << shift;
+		line[(x + i) * bpp / 8] = (line[(x + i) * bpp / 8] & ~mask) | ((in[i] << shift) & mask);
+	}
 }
 
 void bmp256_blit(BITMAP256 *src, unsigned int srcx, unsigned int srcy, BITMAP256 *dest, unsigned int destx, unsigned int desty, unsigned int width, unsigned int height) {
-	unsigned int x, y;
-	int c;
+	uint8_t row[BLIT_CHUNK];
+	const uint8_t *convert, *s;
+	uint8_t *d;
+	uint64_t pix;
+	unsigned int x, y, cx, count, i;
+	int identity;
 
 	/* Sanitise arguments */
 	if (srcx > src->width) srcx = src->width - 1;
@@ -560,28 +1575,75 @@ void bmp256_blit(BITMAP256 *src, unsigned int srcx, unsigned int srcy, BITMAP256
 	if (desty > dest->height) desty = dest->height - 1;
 	if (desty + height > dest->height) height = dest->height - desty;
 
-	/* Copy the data */
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			/* Read a pixel, and convert it between bpp */
-			c = bmp256_getpixel(src, srcx + x, srcy + y);
-			if (src->bpp == 1 && dest->bpp == 2)
-				c = (c == 1 ? 3 : 0);
-			else if (src->bpp == 1 && dest->bpp == 4)
-				c = (c == 1 ? 15 : 0);
-			else if (src->bpp == 1 && dest->bpp == 8)
-				c = (c == 1 ? 15 : 0);
+	if (!width || !height)
+		return;
 
-			else if (src->bpp == 4 && dest->bpp == 1)
-				c = (c > 7 ? 1 : 0);
-			else if (src->bpp == 4 && dest->bpp == 8)
-				c = c;
-			else if (src->bpp == 8 && dest->bpp == 1)
-				c = (c > 7 ? 1 : 0);
-			else if (src->bpp == 8 && dest->bpp == 4)
-				c = (c % 16);
+	/* Whole bytes can be copied between bitmaps of the same bpp, as long as
+	 * both rows start on a byte boundary */
+	x = 0;
+	if (src->bpp == dest->bpp && !(srcx * src->bpp & 7) && !(destx * dest->bpp & 7)) {
+		x = width * src->bpp / 8 * 8 / src->bpp;
+		for (y = 0; y < height; y++)
+			memcpy(dest->lines[desty + y] + destx * dest->bpp / 8,
+					src->lines[srcy + y] + srcx * src->bpp / 8, x * src->bpp / 8);
+		if (x == width)
+			return;
+	}
+
+	/* The common conversions have their own row loops. 1bpp pixels are 0 or
+	 * 1, so multiplying the expanded bytes by 15 gives 0 or 15. */
+	bmp256_init_blit_luts();
+	if (src->bpp == 1 && (dest->bpp == 4 || dest->bpp == 8) && !(srcx & 7) && !(destx & 1)) {
+		x = width & ~7;
+		for (y = 0; y < height; y++) {
+			s = src->lines[srcy + y] + srcx / 8;
+			d = dest->lines[desty + y];
+			for (cx = 0; cx < x; cx += 8) {
+				if (dest->bpp == 8) {
+					pix = MergeLut8[*s++] * 15;
+					for (i = 0; i < 8; i++)
+						d[destx + cx + i] = pix >> (i * 8);
+				} else {
+					pix = MergeLut4[*s++] * 15;
+					for (i = 0; i < 4; i++)
+						d[(destx + cx) / 2 + i] = pix >> (i * 8);
+				}
+			}
+		}
+	} else if (src->bpp == 4 && dest->bpp == 8 && !(srcx & 1)) {
+		x = width & ~1;
+		for (y = 0; y < height; y++) {
+			s = src->lines[srcy + y] + srcx / 2;
+			d = dest->lines[desty + y] + destx;
+			for (cx = 0; cx < x; cx += 2, s++) {
+				d[cx] = *s >> 4;
+				d[cx + 1] = *s & 0x0F;
+			}
+		}
+	} else if (src->bpp == 8 && dest->bpp == 4 && !(destx & 1)) {
+		x = width & ~1;
+		for (y = 0; y < height; y++) {
+			s = src->lines[srcy + y] + srcx;
+			d = dest->lines[desty + y] + destx / 2;
+			for (cx = 0; cx < x; cx += 2)
+				*d++ = (s[cx] & 0x0F) << 4 | (s[cx + 1] & 0x0F);
+		}
+	}
+	if (x == width)
+		return;
+
+	/* Anything else is unpacked to a byte per pixel, converted, and packed */
+	convert = BlitLut[BPP_INDEX(src->bpp)][BPP_INDEX(dest->bpp)];
+	identity = BlitIdentity[BPP_INDEX(src->bpp)][BPP_INDEX(dest->bpp)];
 
-			bmp256_putpixel(dest, destx + x, desty + y, c);
+	for (y = 0; y < height; y++) {
+		for (cx = x; cx < width; cx += count) {
+			count = (width - cx < BLIT_CHUNK) ? width - cx : BLIT_CHUNK;
+			bmp256_read_row(src->lines[srcy + y], src->bpp, srcx + cx, count, row);
+			if (!identity)
+				for (i = 0; i < count; i++)
+					row[i] = convert[row[i]];
+			bmp256_write_row(dest->lines[desty + y], dest->bpp, destx + cx, count, row);
 		}
 	}
 }
@@ -628,9 +1690,13 @@ void bmp256_unpack(BITMAP256 *bmp) {
 		}
 	}
 
-	free(bmp->lines);
-	free(bmp->bits);
+	if (!(bmp->flags & BMP256_INLINE)) {
+		free(bmp->lines);
+		free(bmp->bits);
+	}
 
+	/* The new lines and pixels have their own blocks */
+	bmp->flags &= ~(BMP256_INLINE | BMP256_POOLED);
 	bmp->bits = upbits;
 	bmp->lines = uplines;
 
@@ -641,8 +1707,7 @@ void bmp256_unpack(BITMAP256 *bmp) {
 // Split one bitmap into several planes, pixel-by-pixel
 int bmp256_munge(BITMAP256 *bmp, BITMAP256 *planes[], unsigned planecount) {
 
-	uint8_t *srcline, *dstline;
-	int x,y,p;
+	int p;
 
 	assert (planecount > 0);
 
@@ -650,32 +1715,137 @@ int bmp256_munge(BITMAP256 *bmp, BITMAP256 *planes[], unsigned planecount) {
 	assert (bmp->width % planecount == 0);
 
 	for (p = 0; p < planecount; p++) {
-		planes[p] = bmp256_create(bmp->width/planecount, bmp->height, bmp->bpp);
+		planes[p] = bmp256_create_ex(bmp->width/planecount, bmp->height, bmp->bpp, BMP256_POOLED);
+		if (!planes[p])
+			return 0;
+	}
 
-		for (y = 0; y < planes[p]->height; y++) {
-			srcline = bmp->lines[y] + p;
-			dstline = planes[p]->lines[y];
+	return bmp256_munge_into(bmp, planes, planecount);
+}
 
-			for (x = 0; x < planes[p]->width; x++) {
-				*dstline = *srcline;
-				dstline++;
-				srcline += planecount;
-			}
+// Deinterleave a row of pwidth * planecount bytes into planecount rows,
+// so byte x of plane p comes from byte x * planecount + p
+static void bmp256_deinterleave_row(const uint8_t *src, uint8_t *dst[], unsigned planecount, unsigned pwidth) {
+
+	unsigned x = 0, p;
+
+#ifdef __SSE2__
+	// Four planes are the usual case (VGA Mode X). Each dword holds a
+	// byte of every plane, so mask or shift each plane's byte down and
+	// pack 64 source bytes into 16 bytes per plane.
+	if (planecount == 4) {
+		const __m128i low = _mm_set1_epi32(0xFF);
+		__m128i v0, v1, v2, v3;
+
+		for (; x + 16 <= pwidth; x += 16) {
+			v0 = _mm_loadu_si128((const __m128i *) (src + x * 4));
+			v1 = _mm_loadu_si128((const __m128i *) (src + x * 4 + 16));
+			v2 = _mm_loadu_si128((const __m128i *) (src + x * 4 + 32));
+			v3 = _mm_loadu_si128((const __m128i *) (src + x * 4 + 48));
+			_mm_storeu_si128((__m128i *) (dst[0] + x), _mm_packus_epi16(
+					_mm_packs_epi32(_mm_and_si128(v0, low), _mm_and_si128(v1, low)),
+					_mm_packs_epi32(_mm_and_si128(v2, low), _mm_and_si128(v3, low))));
+			_mm_storeu_si128((__m128i *) (dst[1] + x), _mm_packus_epi16(
+					_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, 8), low), _mm_and_si128(_mm_srli_epi32(v1, 8), low)),
+					_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v2, 8), low), _mm_and_si128(_mm_srli_epi32(v3, 8), low))));
+			_mm_storeu_si128((__m128i *) (dst[2] + x), _mm_packus_epi16(
+					_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, 16), low), _mm_and_si128(_mm_srli_epi32(v1, 16), low)),
+					_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v2, 16), low), _mm_and_si128(_mm_srli_epi32(v3, 16), low))));
+			_mm_storeu_si128((__m128i *) (dst[3] + x), _mm_packus_epi16(
+					_mm_packs_epi32(_mm_srli_epi32(v0, 24), _mm_srli_epi32(v1, 24)),
+					_mm_packs_epi32(_mm_srli_epi32(v2, 24), _mm_srli_epi32(v3, 24))));
 		}
 	}
+#endif
+	for (; x < pwidth; x++)
+		for (p = 0; p < planecount; p++)
+			dst[p][x] = src[x * planecount + p];
+}
+
+// Interleave planecount rows of pwidth bytes into one row
+static void bmp256_interleave_row(const uint8_t *src[], uint8_t *dst, unsigned planecount, unsigned pwidth) {
+
+	unsigned x = 0, p;
+
+#ifdef __SSE2__
+	if (planecount == 4) {
+		__m128i a, b, c, d, ab, cd;
+
+		for (; x + 16 <= pwidth; x += 16) {
+			a = _mm_loadu_si128((const __m128i *) (src[0] + x));
+			b = _mm_loadu_si128((const __m128i *) (src[1] + x));
+			c = _mm_loadu_si128((const __m128i *) (src[2] + x));
+			d = _mm_loadu_si128((const __m128i *) (src[3] + x));
+			ab = _mm_unpacklo_epi8(a, b);
+			cd = _mm_unpacklo_epi8(c, d);
+			_mm_storeu_si128((__m128i *) (dst + x * 4), _mm_unpacklo_epi16(ab, cd));
+			_mm_storeu_si128((__m128i *) (dst + x * 4 + 16), _mm_unpackhi_epi16(ab, cd));
+			ab = _mm_unpackhi_epi8(a, b);
+			cd = _mm_unpackhi_epi8(c, d);
+			_mm_storeu_si128((__m128i *) (dst + x * 4 + 32), _mm_unpacklo_epi16(ab, cd));
+			_mm_storeu_si128((__m128i *) (dst + x * 4 + 48), _mm_unpackhi_epi16(ab, cd));
+		}
+	}
+#endif
+	for (; x < pwidth; x++)
+		for (p = 0; p < planecount; p++)
+			dst[x * planecount + p] = src[p][x];
+}
+
+// Split one bitmap into several existing planes, pixel-by-pixel
+int bmp256_munge_into(BITMAP256 *bmp, BITMAP256 *planes[], unsigned planecount) {
+
+	uint8_t *dst[8];
+	int y,p;
+
+	assert (planecount > 0 && planecount <= 8);
+	assert (bmp->bpp == 8);
+	assert (bmp->width % planecount == 0);
+	for (p = 0; p < planecount; p++) {
+		assert(planes[p] && planes[p]->bpp == bmp->bpp &&
+				planes[p]->width == bmp->width/planecount &&
+				planes[p]->height == bmp->height);
+	}
+
+	for (y = 0; y < bmp->height; y++) {
+		for (p = 0; p < planecount; p++)
+			dst[p] = planes[p]->lines[y];
+		bmp256_deinterleave_row(bmp->lines[y], dst, planecount, bmp->width / planecount);
+	}
 
 	return 1;
 }
 
+// Split one bitmap straight into planar data: planecount planes one after
+// the other, each with height rows of width / planecount bytes
+void bmp256_munge_planar(BITMAP256 *bmp, unsigned char *data, unsigned planecount) {
+
+	uint8_t *dst[8];
+	unsigned pwidth;
+	int y,p;
+
+	assert (planecount > 0 && planecount <= 8);
+	assert (bmp->bpp == 8);
+	assert (bmp->width % planecount == 0);
+
+	pwidth = bmp->width / planecount;
+	for (y = 0; y < bmp->height; y++) {
+		for (p = 0; p < planecount; p++)
+			dst[p] = data + (p * bmp->height + y) * pwidth;
+		bmp256_deinterleave_row(bmp->lines[y], dst, planecount, pwidth);
+	}
+}
+
 // Merge several planes into one bitmap, pixel-by-pixel
 BITMAP256 *bmp256_demunge(BITMAP256 *planes[], unsigned planecount, int bpp) {
 
 	BITMAP256 *bmp;
+	const uint8_t *src[8];
 	int pwidth, height, width;
-	int x,y,p;
-	uint8_t *dstline, *srcline;
+	int y,p;
 
-	assert (planecount > 0);
+	assert (planecount > 0 && planecount <= 8);
+	assert (bpp == 8);
 	
 	// Ensure planes are of equal dimension and bpp
 	pwidth = planes[0]->width;
@@ -688,22 +1858,40 @@ BITMAP256 *bmp256_demunge(BITMAP256 *planes[], unsigned planecount, int bpp) {
 
 	width = pwidth * planecount;
 
-	bmp = bmp256_create(width, height, bpp);
+	bmp = bmp256_create_ex(width, height, bpp, BMP256_POOLED);
+	if (!bmp)
+		return NULL;
 
-	for (p = 0; p < planecount; p++) {
-		for (y = 0; y<height; y++) {
-			dstline = bmp->lines[y] + p;
-			srcline = planes[p]->lines[y];
-
-			for (x = 0; x<pwidth; x++) {
-				*dstline = *srcline;
-				dstline += planecount;
-				srcline++;
-			}
-		}
+	for (y = 0; y < height; y++) {
+		for (p = 0; p < planecount; p++)
+			src[p] = planes[p]->lines[y];
+		bmp256_interleave_row(src, bmp->lines[y], planecount, pwidth);
 	}
 
 	return bmp;
 
 }
 
+// Merge planar data, laid out as bmp256_munge_planar writes it, into a new
+// 8bpp bitmap
+BITMAP256 *bmp256_demunge_planar(const unsigned char *data, unsigned pwidth, unsigned height, unsigned planecount) {
+
+	BITMAP256 *bmp;
+	const uint8_t *src[8];
+	int y,p;
+
+	assert (planecount > 0 && planecount <= 8);
+
+	bmp = bmp256_create_ex(pwidth * planecount, height, 8, BMP256_POOLED);
+	if (!bmp)
+		return NULL;
+
+	for (y = 0; y < height; y++) {
+		for (p = 0; p < planecount; p++)
+			src[p] = data + (p * height + y) * pwidth;
+		bmp256_interleave_row(src, bmp->lines[y], planecount, pwidth);
+	}
+
+	return bmp;
+
+}
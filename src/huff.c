@@ -20,8 +20,12 @@
 */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "pconio.h"
 #include "utils.h"
+#include "huff.h"
 
 typedef struct
 {
@@ -31,15 +35,79 @@ typedef struct
 
 typedef struct {
 	int num;
-	unsigned long bits;
+	uint64_t bits;
 } compstruct;
 
-static nodestruct nodes[256]; /* Only 255 should be used, but xGADICT generally has an additional zero node */
-static compstruct comptable[256];
+/* Number of input bits resolved by one lookup in the table-driven decoder */
+#define HUFF_LOOKUP_BITS 10
+#define HUFF_LOOKUP_SIZE (1 << HUFF_LOOKUP_BITS)
+#define HUFF_LOOKUP_MAXSYMS 4
 
+typedef struct {
+	uint8_t count;	/* Complete symbols decoded from this bit pattern (0 = long code) */
+	uint8_t bits;	/* Bits consumed by those symbols */
+	uint16_t node;	/* For long codes, the node reached after HUFF_LOOKUP_BITS bits */
+	uint8_t syms[HUFF_LOOKUP_MAXSYMS];
+} lookupstruct;
+
+/* Everything needed to encode and decode with one dictionary */
+struct HuffContext
+{
+	nodestruct nodes[256]; /* Only 255 should be used, but xGADICT generally has an additional zero node */
+	compstruct comptable[256];
+	lookupstruct lookup[HUFF_LOOKUP_SIZE];
+	int lookup_valid;
+};
+
+/* The context used by the original, context-less entry points */
+static HuffContext defaultctx;
+
+/* Build the decoding lookup table from the current dictionary. Each entry
+** decodes as many whole symbols (up to HUFF_LOOKUP_MAXSYMS) as fit in the
+** next HUFF_LOOKUP_BITS input bits, which are consumed LSB first. */
+static void huff_build_lookup(HuffContext *ctx)
+{
+	unsigned int pattern, bit, curnode, nextnode;
+	lookupstruct *e;
 
-/* Expand huffman-compressed input file into output buffer */
-void huff_expand(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen)
+	for (pattern = 0; pattern < HUFF_LOOKUP_SIZE; pattern++)
+	{
+		e = &ctx->lookup[pattern];
+		e->count = 0;
+		e->bits = 0;
+		curnode = 254;
+
+		for (bit = 0; bit < HUFF_LOOKUP_BITS; bit++)
+		{
+			if (pattern & (1 << bit))
+				nextnode = ctx->nodes[curnode].bit1;
+			else
+				nextnode = ctx->nodes[curnode].bit0;
+
+			if (nextnode < 256)
+			{
+				e->syms[e->count++] = nextnode;
+				e->bits = bit + 1;
+				curnode = 254;
+				if (e->count == HUFF_LOOKUP_MAXSYMS)
+					break;
+			}
+			else
+			{
+				curnode = nextnode & 0xFF;
+			}
+		}
+
+		/* Only used when no symbol completed within the lookup bits */
+		e->node = curnode;
+	}
+
+	ctx->lookup_valid = 1;
+}
+
+/* Expand huffman-compressed input file into output buffer, walking the
+** dictionary tree one bit at a time. This is the reference decoder. */
+void huff_ctx_expand_tree(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen)
 {
 	unsigned short curnode;
 	unsigned long incnt = 0, outcnt = 0;
@@ -57,9 +125,9 @@ void huff_expand(unsigned char *pin, unsigned char *pout, unsigned long inlen, u
 		do
 		{
 			if(c & mask)
-				nextnode = nodes[curnode].bit1;
+				nextnode = ctx->nodes[curnode].bit1;
 			else
-				nextnode = nodes[curnode].bit0;
+				nextnode = ctx->nodes[curnode].bit0;
 
 
 			if(nextnode < 256)
@@ -83,124 +151,491 @@ void huff_expand(unsigned char *pin, unsigned char *pout, unsigned long inlen, u
 	while(incnt < inlen && outcnt < outlen);
 }
 
+/* Expand huffman-compressed input file into output buffer, resolving
+** HUFF_LOOKUP_BITS input bits per table lookup. Codes longer than that
+** fall back to the tree. The output is identical to huff_ctx_expand_tree. */
+void huff_ctx_expand(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen)
+{
+	unsigned char *inend = pin + inlen;
+	unsigned char *outend = pout + outlen;
+	uint64_t bitbuf = 0;
+	int bitcnt = 0, k;
+	unsigned short curnode, nextnode;
+	const lookupstruct *e;
+
+	/* The reference decoder always consumes at least one byte and emits at
+	** least one symbol; leave those degenerate cases to it */
+	if (inlen == 0 || outlen == 0)
+	{
+		huff_ctx_expand_tree(ctx, pin, pout, inlen, outlen);
+		return;
+	}
 
-/* Read the huffman dictionary from a file */
-void huff_read_dictionary(FILE *fin, unsigned long offset)
+	if (!ctx->lookup_valid)
+		huff_build_lookup(ctx);
+
+	while (pout < outend)
+	{
+		/* Top up the bit buffer */
+		while (bitcnt <= 56 && pin < inend)
+		{
+			bitbuf |= (uint64_t)*(pin++) << bitcnt;
+			bitcnt += 8;
+		}
+		if (bitcnt < HUFF_LOOKUP_BITS)
+			break;
+
+		e = &ctx->lookup[bitbuf & (HUFF_LOOKUP_SIZE - 1)];
+		if (e->count)
+		{
+			for (k = 0; k < e->count && pout < outend; k++)
+				*(pout++) = e->syms[k];
+			bitbuf >>= e->bits;
+			bitcnt -= e->bits;
+			continue;
+		}
+
+		/* A long code: carry on down the tree from where the table stopped */
+		bitbuf >>= HUFF_LOOKUP_BITS;
+		bitcnt -= HUFF_LOOKUP_BITS;
+		curnode = e->node;
+		do
+		{
+			if (bitcnt == 0)
+			{
+				if (pin == inend)
+					return;
+				bitbuf = *(pin++);
+				bitcnt = 8;
+			}
+			nextnode = (bitbuf & 1) ? ctx->nodes[curnode].bit1 : ctx->nodes[curnode].bit0;
+			bitbuf >>= 1;
+			bitcnt--;
+			curnode = nextnode & 0xFF;
+		}
+		while (nextnode >= 256);
+		*(pout++) = nextnode;
+	}
+
+	/* Fewer than HUFF_LOOKUP_BITS bits remain: finish off bit by bit */
+	curnode = 254;
+	while (bitcnt > 0 && pout < outend)
+	{
+		nextnode = (bitbuf & 1) ? ctx->nodes[curnode].bit1 : ctx->nodes[curnode].bit0;
+		bitbuf >>= 1;
+		bitcnt--;
+
+		if (nextnode < 256)
+		{
+			*(pout++) = nextnode;
+			curnode = 254;
+		}
+		else
+		{
+			curnode = nextnode & 0xFF;
+		}
+	}
+}
+
+
+/* Check that the dictionary is a proper binary tree rooted at the head node:
+** every child is a byte or an existing node, and no node is reachable twice
+** (so there are no cycles). For compression every byte must also appear
+** exactly once. Returns 1 if valid. */
+static int huff_check_tree(HuffContext *ctx, int forcompression)
 {
+	unsigned char seennode[255] = {0};
+	unsigned char seenleaf[256] = {0};
+	unsigned short stacknode[2 * 255];
+	int sp = 0, numleaves = 0;
+	unsigned short curnode, child;
+	int bit;
+
+	stacknode[sp++] = 254;
+	while (sp > 0)
+	{
+		sp--;
+		curnode = stacknode[sp];
+		if (seennode[curnode])
+			return 0;
+		seennode[curnode] = 1;
+
+		for (bit = 0; bit < 2; bit++)
+		{
+			child = bit ? ctx->nodes[curnode].bit1 : ctx->nodes[curnode].bit0;
+			if (child < 256)
+			{
+				if (!forcompression)
+					continue;
+				if (seenleaf[child])
+					return 0;
+				seenleaf[child] = 1;
+				numleaves++;
+			}
+			else
+			{
+				if ((child & 0xFF) == 255 || child > 511)
+					return 0;
+				/* Each node is popped at most once, so the stack can't overflow */
+				stacknode[sp++] = child & 0xFF;
+			}
+		}
+	}
+
+	return !forcompression || numleaves == 256;
+}
+
+/* Read the huffman dictionary from a file. Returns 0 if it could not be
+** read or is not a valid tree. */
+int huff_ctx_read_dictionary(HuffContext *ctx, FILE *fin, unsigned long offset)
+{
+	ctx->lookup_valid = 0;
 	fseek(fin, offset, SEEK_SET);
-	fread(nodes, sizeof(nodestruct), 255, fin);
+	if (fread(ctx->nodes, sizeof(nodestruct), 255, fin) != 255)
+		return 0;
+	return huff_check_tree(ctx, 0);
 }
 
 /* Write the huffman dictionary to a file */
-void huff_write_dictionary(FILE *fout)
+void huff_ctx_write_dictionary(HuffContext *ctx, FILE *fout)
 {
-	fwrite(nodes, sizeof(nodestruct), 256, fout); // Includes last zero node
+	fwrite(ctx->nodes, sizeof(nodestruct), 256, fout); // Includes last zero node
 }
 
-void trace_node(int curnode, int numbits, unsigned long curbits)
+static void trace_node(HuffContext *ctx, int curnode, int numbits, uint64_t curbits)
 {
 	int bit0, bit1;
 
 	if(curnode < 256)
 	{
 		/* This is a character */
-		comptable[curnode].num = numbits;
-		comptable[curnode].bits = curbits;
-		if( numbits > 32 )
-			do_output("HUFF: Comptable only allows 32 bits max for node %d!\n", curnode);
+		ctx->comptable[curnode].num = numbits;
+		ctx->comptable[curnode].bits = curbits;
 	}
 	else
 	{
 		/* This is another node */
-		bit0 = nodes[curnode & 0xFF].bit0;
-		bit1 = nodes[curnode & 0xFF].bit1;
+		bit0 = ctx->nodes[curnode & 0xFF].bit0;
+		bit1 = ctx->nodes[curnode & 0xFF].bit1;
 		numbits++;
 		
-		trace_node(bit0, numbits, curbits);
-		trace_node(bit1, numbits, (curbits | (1UL << (numbits - 1))));
+		/* Codes longer than 64 bits can't be stored, but only bytes that
+		** never occur get them, so their bits don't matter */
+		trace_node(ctx, bit0, numbits, curbits);
+		trace_node(ctx, bit1, numbits, numbits <= 64 ? (curbits | ((uint64_t)1 << (numbits - 1))) : curbits);
 	}
 }
 
-/* Takes the counts array and builds a huffman tree at nodes array. */
+/* Length in bits of the code for byte c, once compression is set up */
+int huff_ctx_code_length(HuffContext *ctx, int c)
+{
+	return ctx->comptable[c & 0xFF].num;
+}
+
+/* Binary min-heap of tree slots used by huffmanize, ordered by probability
+** and then by slot number */
+typedef struct {
+	uint64_t prob;
+	unsigned short slot;
+} heapentry;
+
+#define HEAP_LESS(a, b) ((a).prob < (b).prob || ((a).prob == (b).prob && (a).slot < (b).slot))
 
-void huffmanize(int counts[])
+static void heap_push(heapentry *heap, int *heapsize, heapentry e)
 {
-	/* codes are either bytes if <256 or nodearray numbers+256 if >=256 */
-	unsigned short value[256],code0,code1;
-	/* probablilities are the number of times the code is hit or $ffffffff if
-	it is allready part of a higher node */
-	unsigned int prob[256],low/*,workprob*/;
+	int i = (*heapsize)++, parent;
 
-	short i,worknode/*,bitlength*/;
-	/*unsigned int bitstring;*/
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (!HEAP_LESS(e, heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = e;
+}
+
+static heapentry heap_pop(heapentry *heap, int *heapsize)
+{
+	heapentry top = heap[0], last = heap[--(*heapsize)];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < *heapsize)
+	{
+		if (child + 1 < *heapsize && HEAP_LESS(heap[child + 1], heap[child]))
+			child++;
+		if (!HEAP_LESS(heap[child], last))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
 
+/* Takes the counts array and builds a huffman tree at nodes array.
+**
+** This builds exactly the tree TED5's huffmanize did: each step merges the
+** two least probable codes, ties going to the lowest slot number, and the
+** merged node takes the slot of the first. Keeping the slots in a heap
+** makes that O(n log n) instead of two linear scans per merge. Returns 0
+** if the resulting tree is invalid. */
+int huff_ctx_huffmanize(HuffContext *ctx, int counts[])
+{
+	/* codes are either bytes if <256 or nodearray numbers+256 if >=256 */
+	unsigned short value[256];
+	heapentry heap[256], e0, e1;
+	int heapsize = 0, i, worknode;
 
 	/* all possible leaves start out as bytes */
-	for (i=0; i<256; i++)
+	for (i = 0; i < 256; i++)
 	{
 		value[i] = i;
-		prob[i] = counts[i];
+		e0.prob = (unsigned int)counts[i];
+		e0.slot = i;
+		heap_push(heap, &heapsize, e0);
 	}
 
-	/* start selecting the lowest probable leaves for the ends of the tree */
+	/* merge the lowest probable codes until only the head node remains */
+	for (worknode = 0; heapsize > 1; worknode++)
+	{
+		e0 = heap_pop(heap, &heapsize);
+		e1 = heap_pop(heap, &heapsize);
 
-	worknode = 0;
-	while (1)	/* break out of when all codes have been used */
+		/* make code0 into a pointer to work, removing code1 */
+		ctx->nodes[worknode].bit0 = value[e0.slot];
+		ctx->nodes[worknode].bit1 = value[e1.slot];
+
+		value[e0.slot] = 256 + worknode;
+		e0.prob += e1.prob;
+		heap_push(heap, &heapsize, e0);
+	}
+	ctx->nodes[255].bit0 = ctx->nodes[255].bit1 = 0;
+	ctx->lookup_valid = 0;
+
+	return huff_check_tree(ctx, 1);
+}
+
+/* Takes the counts array and builds a huffman tree at nodes array in which
+** no code is longer than maxbits, using the package-merge algorithm. The
+** code lengths are optimal for that limit. Nodes are numbered bottom up so
+** that the head is node 254, as with huffmanize. Returns 0 if maxbits is
+** too small to give all 256 bytes a code, or too large, or if there isn't
+** enough memory. */
+int huff_ctx_huffmanize_limited(HuffContext *ctx, int counts[], int maxbits)
+{
+	/* One list of items per code length; each item is a byte or a package
+	** of two items from the previous list. They belong to this call alone,
+	** so contexts can build their dictionaries at the same time. */
+	uint64_t (*weight)[2 * 256];
+	short (*symbol)[2 * 256];	/* -1 for packages */
+	int listlen[HUFF_MAX_CODE_BITS];
+	unsigned short sorted[256], level[2 * 256], nextlevel[2 * 256];
+	int codelen[256];
+	int i, j, k, d, n, take, packages, numlevel, numnext, worknode;
+	uint64_t pkweight = 0;
+	unsigned short t;
+
+	if (maxbits < 8 || maxbits > HUFF_MAX_CODE_BITS)
+		return 0;
+	weight = malloc(maxbits * sizeof(*weight));
+	symbol = malloc(maxbits * sizeof(*symbol));
+	if (!weight || !symbol)
 	{
-		/* find the two lowest probability codes */
+		free(weight);
+		free(symbol);
+		return 0;
+	}
 
-		code0=0xffff;
-		low = 0x7fffffff;
-		for (i=0;i<256;i++)
-			if (prob[i]<low)
+	/* Sort the bytes by count (insertion sort keeps equal counts in byte order) */
+	for (i = 0; i < 256; i++)
+	{
+		t = i;
+		for (j = i; j > 0 && (unsigned int)counts[sorted[j - 1]] > (unsigned int)counts[t]; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = t;
+	}
+
+	/* The deepest list is just the bytes; each shallower list merges the
+	** bytes with the pairs of the list before it */
+	for (i = 0; i < 256; i++)
+	{
+		weight[0][i] = (unsigned int)counts[sorted[i]];
+		symbol[0][i] = sorted[i];
+	}
+	listlen[0] = 256;
+	for (d = 1; d < maxbits; d++)
+	{
+		n = 0;
+		i = 0;
+		j = 0;
+		while (i < 256 || j + 1 < listlen[d - 1])
+		{
+			if (j + 1 < listlen[d - 1])
+				pkweight = weight[d - 1][j] + weight[d - 1][j + 1];
+			if (i < 256 && (j + 1 >= listlen[d - 1] || (unsigned int)counts[sorted[i]] <= pkweight))
 			{
-				code0 = i;
-				low = prob[i];
+				weight[d][n] = (unsigned int)counts[sorted[i]];
+				symbol[d][n++] = sorted[i++];
 			}
-
-		code1=0xffff;
-		low = 0x7fffffff;
-		for (i=0;i<256;i++)
-			if (prob[i]<low && i != code0)
+			else
 			{
-				code1 = i;
-				low = prob[i];
+				weight[d][n] = pkweight;
+				symbol[d][n++] = -1;
+				j += 2;
 			}
+		}
+		listlen[d] = n;
+	}
 
-		if (code1 == 0xffff)
+	/* The first 2n-2 items of the last list make up the code; each time a
+	** byte is used in it, its code gets one bit longer */
+	for (i = 0; i < 256; i++)
+		codelen[i] = 0;
+	take = 2 * 256 - 2;
+	for (d = maxbits - 1; d >= 0 && take > 0; d--)
+	{
+		packages = 0;
+		for (i = 0; i < take; i++)
 		{
-			if (value[code0]<256)
-				quit("Wierdo huffman error: last code wasn't a node!");
-			if (value[code0]-256 != 254)
-				quit("Wierdo huffman error: headnode wasn't 254!");
-			break;
+			if (symbol[d][i] < 0)
+				packages++;
+			else
+				codelen[symbol[d][i]]++;
+		}
+		take = 2 * packages;
+	}
+	free(weight);
+	free(symbol);
+
+	/* Build the tree from the code lengths, from the deepest level up.
+	** Items at each depth are paired into nodes for the depth above. */
+	worknode = 0;
+	numlevel = 0;
+	for (d = maxbits; d > 0; d--)
+	{
+		for (i = 0; i < 256; i++)
+			if (codelen[i] == d)
+				level[numlevel++] = i;
+		if (numlevel & 1)
+			return 0;
+
+		numnext = 0;
+		for (k = 0; k < numlevel; k += 2)
+		{
+			ctx->nodes[worknode].bit0 = level[k];
+			ctx->nodes[worknode].bit1 = level[k + 1];
+			nextlevel[numnext++] = 256 + worknode;
+			worknode++;
 		}
+		for (k = 0; k < numnext; k++)
+			level[k] = nextlevel[k];
+		numlevel = numnext;
+	}
+	if (numlevel != 1 || worknode != 255)
+		return 0;
+	ctx->nodes[255].bit0 = ctx->nodes[255].bit1 = 0;
+	ctx->lookup_valid = 0;
+
+	return huff_check_tree(ctx, 1);
+}
+
+/* Exact number of bytes huff_ctx_compress will output for inlen (> 0) bytes
+** with these byte counts, given enough room, including the partial last byte
+** and the trailing byte added by igrabhufftrailmode. Compression must be set
+** up. */
+unsigned long huff_ctx_compressed_size(HuffContext *ctx, int counts[], unsigned long inlen, int igrabhufftrailmode)
+{
+	uint64_t bits = huff_ctx_encoded_bits(ctx, counts);
+	unsigned long bytes = (unsigned long)((bits + 7) / 8);
+
+	if ((bits & 7) == 0 &&
+	    ((igrabhufftrailmode == 1) ||
+	     ((igrabhufftrailmode == 2) && (inlen < 60000))))
+		bytes++;
 
-		/* make code0 into a pointer to work
-		remove code1 (make 0xffffffff prob) */
-		nodes[worknode].bit0 = value[code0];
-		nodes[worknode].bit1 = value[code1];
+	return bytes;
+}
+
+/* Chunks shorter than this are counted straight into the caller's table */
+#define HISTOGRAM_MIN_SPLIT 1024
+
+/* Add the number of times each byte occurs in data to counts. Planar
+** graphics have long runs of the same byte, and incrementing one counter
+** over and over makes each increment wait for the previous store. So
+** successive bytes are counted in four separate tables, read a 32-bit
+** word at a time, and the tables are added together at the end. */
+void huff_histogram(unsigned char *data, unsigned long len, int counts[])
+{
+	uint32_t sub[4][256];
+	uint32_t w0, w1;
+	int i;
 
-		value[code0] = 256 + worknode;
-		prob[code0] += prob[code1];
-		prob[code1] = 0xffffffff;
-		worknode++;
+	if (len < HISTOGRAM_MIN_SPLIT)
+	{
+		while (len--)
+			counts[*(data++)]++;
+		return;
+	}
+
+	memset(sub, 0, sizeof(sub));
+	while (len >= 8)
+	{
+		memcpy(&w0, data, 4);
+		memcpy(&w1, data + 4, 4);
+		sub[0][w0 & 0xFF]++;
+		sub[1][(w0 >> 8) & 0xFF]++;
+		sub[2][(w0 >> 16) & 0xFF]++;
+		sub[3][w0 >> 24]++;
+		sub[0][w1 & 0xFF]++;
+		sub[1][(w1 >> 8) & 0xFF]++;
+		sub[2][(w1 >> 16) & 0xFF]++;
+		sub[3][w1 >> 24]++;
+		data += 8;
+		len -= 8;
 	}
+	while (len--)
+		sub[0][*(data++)]++;
+
+	for (i = 0; i < 256; i++)
+		counts[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+}
+
+/* Number of bits needed to encode data with these byte counts, once
+** compression is set up */
+uint64_t huff_ctx_encoded_bits(HuffContext *ctx, int counts[])
+{
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		total += (uint64_t)(unsigned int)counts[i] * ctx->comptable[i].num;
+	return total;
 }
 
-void huff_setup_compression()
+/* Build the compression table from the dictionary. Returns 0 if the
+** dictionary does not contain every byte. Codes longer than
+** HUFF_MAX_CODE_BITS are recorded but cannot be encoded; callers should
+** check huff_ctx_code_length for the bytes they will compress. */
+int huff_ctx_setup_compression(HuffContext *ctx)
 {
+	if (!huff_check_tree(ctx, 1))
+		return 0;
+
 	/* Trace down the Huffman tree, recording the bits into the relevant compstruct entry. */
-	trace_node((254 | 256), 0, 0);
+	trace_node(ctx, (254 | 256), 0, 0);
+	return 1;
 }
 
-/* Compress data using huffman dictionary from input buffer into output buffer */
-unsigned long huff_compress(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode)
+/* Compress data using huffman dictionary from input buffer into output buffer,
+** emitting one bit at a time. This is the reference encoder. */
+unsigned long huff_ctx_compress_bitwise(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode)
 {
 	unsigned long outcnt;
 	unsigned long incnt;
 	unsigned char cout;
-	unsigned long bits;
+	uint64_t bits;
 	int numbitsin, numbitsout, numbits;
 	unsigned char c;
 
@@ -211,8 +646,8 @@ unsigned long huff_compress(unsigned char *pin, unsigned char *pout, unsigned lo
 		c = *(pin++);
 		incnt++;
       
-		bits = comptable[c].bits;
-		numbits = comptable[c].num;
+		bits = ctx->comptable[c].bits;
+		numbits = ctx->comptable[c].num;
 		
 		numbitsin = 0;
       
@@ -251,3 +686,184 @@ unsigned long huff_compress(unsigned char *pin, unsigned char *pout, unsigned lo
 	return outcnt;
 }
 
+/* Compress data using huffman dictionary from input buffer into output buffer.
+** Whole codes are ORed into a 64-bit accumulator which is flushed 32 bits at
+** a time. The output is identical to huff_ctx_compress_bitwise. */
+unsigned long huff_ctx_compress(HuffContext *ctx, unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode)
+{
+	unsigned long outcnt;
+	unsigned long incnt;
+	unsigned char cout;
+	uint64_t bits;
+	int numbitsin, numbitsout, numbits;
+	unsigned char c;
+	uint64_t acc;
+	int accbits;
+
+	/* The word-at-a-time loop needs room to flush whole words; leave
+	** the degenerate cases to the reference encoder */
+	if (inlen == 0 || outlen < 16)
+		return huff_ctx_compress_bitwise(ctx, pin, pout, inlen, outlen, igrabhufftrailmode);
+
+	incnt = outcnt = 0;
+	acc = 0;
+	accbits = 0;
+	do {
+		c = *(pin++);
+		incnt++;
+
+		bits = ctx->comptable[c].bits;
+		numbits = ctx->comptable[c].num;
+		if (numbits == 0)
+			numbits = 1;	/* The bitwise encoder always emits at least one bit */
+
+		/* Codes longer than 32 bits are added in 32-bit pieces */
+		while (numbits > 32)
+		{
+			acc |= (uint64_t)(bits & 0xFFFFFFFFUL) << accbits;
+			bits >>= 32;
+			numbits -= 32;
+			*(pout++) = (unsigned char)acc;
+			*(pout++) = (unsigned char)(acc >> 8);
+			*(pout++) = (unsigned char)(acc >> 16);
+			*(pout++) = (unsigned char)(acc >> 24);
+			outcnt += 4;
+			acc >>= 32;
+			if (outlen - outcnt < 16)
+				break;
+		}
+		if (numbits > 32)
+			break;	/* Out of room mid-code: finish it bit by bit below */
+
+		acc |= (uint64_t)(bits & (0xFFFFFFFFUL >> (32 - numbits))) << accbits;
+		accbits += numbits;
+
+		/* Flush 32 bits at a time */
+		if (accbits >= 32)
+		{
+			*(pout++) = (unsigned char)acc;
+			*(pout++) = (unsigned char)(acc >> 8);
+			*(pout++) = (unsigned char)(acc >> 16);
+			*(pout++) = (unsigned char)(acc >> 24);
+			outcnt += 4;
+			acc >>= 32;
+			accbits -= 32;
+		}
+		numbits = 0;
+	} while(incnt < inlen && outlen - outcnt >= 16);
+
+	/* Flush whole bytes, and leave any partial byte where the bitwise
+	** encoder would have it: in the top bits of cout */
+	while (accbits >= 8)
+	{
+		*(pout++) = (unsigned char)acc;
+		outcnt++;
+		acc >>= 8;
+		accbits -= 8;
+	}
+	numbitsout = accbits;
+	cout = numbitsout ? (unsigned char)(acc << (8 - numbitsout)) : 0;
+
+	/* Near the end of the output buffer, carry on a bit at a time so
+	** that the outlen cap truncates exactly as the bitwise encoder does */
+	numbitsin = 0;
+	while (outcnt < outlen && (numbits > 0 || incnt < inlen))
+	{
+		if (numbits == 0)
+		{
+			c = *(pin++);
+			incnt++;
+			bits = ctx->comptable[c].bits;
+			numbits = ctx->comptable[c].num;
+			numbitsin = 0;
+		}
+
+		do {
+			/* Output a bit to the buffer */
+			cout >>= 1;
+			cout |= (unsigned char)((bits & 1) << 7);
+			bits >>= 1;
+
+			numbitsout++;
+			numbitsin++;
+
+			if(numbitsout == 8)
+			{
+				*(pout++) = cout;
+				outcnt++;
+				numbitsout = 0;
+				cout = 0;
+			}
+		} while(numbitsin < numbits && outcnt < outlen);
+		numbits = 0;
+	}
+
+	/* Output any remaining bits, or even just an additional    */
+	/* trailing zero byte, based on value of igrabhufftrailmode */
+	/* (used for emulating a few variants of an IGRAB quirk)    */
+	if (((numbitsout > 0) ||
+	     (igrabhufftrailmode == 1) ||
+	     ((igrabhufftrailmode == 2) && (inlen < 60000))
+	    ) && (outcnt < outlen)
+	) {
+		cout >>= (8 - numbitsout);
+		*(pout++) = cout;
+		outcnt++;
+	}
+
+	return outcnt;
+}
+
+/* Create a context with an empty dictionary */
+HuffContext *huff_ctx_create()
+{
+	return (HuffContext *)calloc(1, sizeof(HuffContext));
+}
+
+void huff_ctx_free(HuffContext *ctx)
+{
+	free(ctx);
+}
+
+
+/* The original entry points work on a single process-wide dictionary */
+
+void huff_expand_tree(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen)
+{
+	huff_ctx_expand_tree(&defaultctx, pin, pout, inlen, outlen);
+}
+
+void huff_expand(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen)
+{
+	huff_ctx_expand(&defaultctx, pin, pout, inlen, outlen);
+}
+
+unsigned long huff_compress_bitwise(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode)
+{
+	return huff_ctx_compress_bitwise(&defaultctx, pin, pout, inlen, outlen, igrabhufftrailmode);
+}
+
+unsigned long huff_compress(unsigned char *pin, unsigned char *pout, unsigned long inlen, unsigned long outlen, int igrabhufftrailmode)
+{
+	return huff_ctx_compress(&defaultctx, pin, pout, inlen, outlen, igrabhufftrailmode);
+}
+
+int huff_read_dictionary(FILE *fin, unsigned long offset)
+{
+	return huff_ctx_read_dictionary(&defaultctx, fin, offset);
+}
+
+void huff_write_dictionary(FILE *fout)
+{
+	huff_ctx_write_dictionary(&defaultctx, fout);
+}
+
+int huffmanize(int counts[])
+{
+	return huff_ctx_huffmanize(&defaultctx, counts);
+}
+
+int huff_setup_compression()
+{
+	return huff_ctx_setup_compression(&defaultctx);
+}
@@ -71,15 +71,20 @@ places num starting points beginning at index start using data from bmp
 */
 void import_points(BITMAP256 *bmp, unsigned int start, unsigned int pnum) {
 
-	unsigned int pcnt,i,j, *allpoints;
+	unsigned int pcnt,i,j,x,y, *allpoints;
 	char screengrid[SCREEN_AREA];
+	BMP256_GETTER get;
 	
-	/* 1st pass: put all non-black points into point array */
+	/* 1st pass: put all non-black points into point array. Anything
+	   outside the bitmap counts as non-black. */
 	memset(&screengrid[0], 0, SCREEN_AREA);
-	for (i = pcnt = 0; i < SCREEN_AREA; i++) {
-		if (bmp256_getpixel(bmp, i%SCREEN_W, i/SCREEN_W)) {
-			screengrid[i]++;
-			pcnt++;
+	get = bmp256_getter(bmp->bpp);
+	for (y = i = pcnt = 0; y < SCREEN_H; y++) {
+		for (x = 0; x < SCREEN_W; x++, i++) {
+			if (x >= bmp->width || y >= bmp->height || get(bmp->lines[y], x)) {
+				screengrid[i]++;
+				pcnt++;
+			}
 		}
 	}
 
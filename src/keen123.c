@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 
 #include <memory.h>
 #include "pconio.h"
@@ -189,11 +190,139 @@ CommandNode SC_VORTICONS[] = {
 
 /************************************************************************************************************/
 
+/* Time the buffer LZ encoder against the reference file encoder on the
+ * latch or sprite data, and check that both produce identical output */
+static void k123_benchmark_compress(char *name, uint8_t *data, unsigned long len) {
+    uint8_t *scratch1, *scratch2;
+    long len1, len2;
+    FILE *fin, *fout;
+    LZContext *ctx;
+    int pass;
+    clock_t start;
+    double filetime, buftime;
+
+    scratch1 = (uint8_t *) malloc(LZ_COMPRESS_BOUND(len));
+    scratch2 = (uint8_t *) malloc(LZ_COMPRESS_BOUND(len));
+    ctx = lz_ctx_create();
+    if (!scratch1 || !scratch2 || !ctx)
+        quit("Not enough memory to benchmark LZ compression!");
+    fin = tmpfile();
+    fout = tmpfile();
+    if (!fin || !fout)
+        quit("Unable to create a temporary file for the LZ benchmark!");
+    fwrite(data, len, 1, fin);
+
+    start = clock();
+    for (pass = 0; pass < BENCHMARK_PASSES; pass++) {
+        rewind(fin);
+        rewind(fout);
+        lz_compress(fin, fout);
+    }
+    filetime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+        lz_ctx_compress(ctx, data, len, scratch2, LZ_COMPRESS_BOUND(len));
+    buftime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    /* Both encoders still hold the output of their last pass */
+    len1 = ftell(fout);
+    rewind(fout);
+    if (len1 < 0 || fread(scratch1, 1, len1, fout) != (unsigned long) len1)
+        quit("Unable to read back the LZ benchmark data!");
+    len2 = lz_ctx_compress(ctx, data, len, scratch2, LZ_COMPRESS_BOUND(len));
+
+    fclose(fin);
+    fclose(fout);
+    lz_ctx_free(ctx);
+
+    do_output("LZ encode benchmark, %s (%lu bytes x %d passes):\n", name, len, BENCHMARK_PASSES);
+    benchmark_line("File:", filetime, len, 0);
+    benchmark_line("Buffer:", buftime, len, filetime);
+    if (len1 != len2 || memcmp(scratch1, scratch2, len1))
+        quit("Buffer LZ encoder disagreed with the reference on %s!", name);
+    free(scratch1);
+    free(scratch2);
+}
+
+/* Load the latch or sprite data from the game file basename, which holds
+ * numplanes planes of planesize bytes. Compressed data is decompressed a
+ * plane at a time, so progress can be shown. */
+static uint8_t *k123_load_planes(char *basename, char *name, uint32_t planesize, int numplanes) {
+    char filename[PATH_MAX];
+    FILE *f;
+    uint8_t *data, *compdata;
+    LZContext *ctx;
+    long complen;
+    int p;
+
+    snprintf(filename, sizeof (filename), "%s/%s.%s", Switches->InputPath, basename, EpisodeInfo.GameExt);
+    f = openfile(filename, "rb", Switches->Backup);
+    if (!f)
+        quit("Cannot open %s!\n", filename);
+    data = (uint8_t *) malloc(planesize * numplanes);
+    if (!data)
+        quit("Not enough memory to load %s!\n", name);
+
+    if (!EgaHead->Compressed) {
+        fread(data, planesize * numplanes, 1, f);
+    } else {
+        /* Skip the 6-byte header in front of the LZ data */
+        fseek(f, 0, SEEK_END);
+        complen = ftell(f) - 6;
+        if (complen <= 0)
+            quit("%s is too short to be compressed!", filename);
+
+        compdata = (uint8_t *) malloc(complen);
+        ctx = lz_ctx_create();
+        if (!compdata || !ctx)
+            quit("Not enough memory to decompress %s!", filename);
+
+        fseek(f, 6, SEEK_SET);
+        if (fread(compdata, complen, 1, f) != 1)
+            quit("Unable to read %s!", filename);
+
+        do_output("Decompressing %s", name);
+        lz_ctx_stream_begin(ctx, compdata, complen);
+        /* Data that ends early would leave the rest of the planes unset */
+        for (p = 0; p < numplanes; p++) {
+            showprogress((p * 100) / numplanes);
+            if (lz_ctx_stream_read(ctx, data + p * planesize, planesize) != (long) planesize)
+                quit("%s is corrupt!", filename);
+        }
+        completemsg();
+
+        lz_ctx_free(ctx);
+        free(compdata);
+    }
+    fclose(f);
+
+    if (Switches->Benchmark)
+        k123_benchmark_compress(name, data, planesize * numplanes);
+
+    return data;
+}
+
+/* The latch data is only loaded once something needs it */
+static void k123_export_load_latch() {
+    if (!LatchData)
+        LatchData = k123_load_planes("egalatch", "latch data", EgaHead->LatchPlaneSize, 4);
+}
+
+/* And freed once nothing else does */
+static void k123_export_free_latch() {
+    free(LatchData);
+    LatchData = NULL;
+}
+
+static void k123_export_load_sprites() {
+    if (!SpriteData)
+        SpriteData = k123_load_planes("egasprit", "sprite data", EgaHead->SpritePlaneSize, 5);
+}
+
 void k123_export_begin(SwitchStruct *switches) {
     char filename[PATH_MAX];
     FILE *headfile = NULL;
-    FILE *latchfile = NULL;
-    FILE *spritefile = NULL;
 
     /* Never allow the export start to occur more than once */
     if (ExportInitialised)
@@ -236,34 +365,11 @@ void k123_export_begin(SwitchStruct *switches) {
     fseek(headfile, EgaHead->OffSpriteTable, SEEK_SET);
     fread(SprHead, 4 * sizeof (SpriteHeadStruct), EgaHead->NumSprites, headfile);
 
-    /* Open the latch and sprite files and read them into memory */
-    sprintf(filename, "%s/egalatch.%s", Switches->InputPath, EpisodeInfo.GameExt);
-    latchfile = openfile(filename, "rb", Switches->Backup);
-    if (!latchfile)
-        quit("Cannot open %s!\n", filename);
-    sprintf(filename, "%s/egasprit.%s", Switches->InputPath, EpisodeInfo.GameExt);
-    spritefile = openfile(filename, "rb", Switches->Backup);
-    if (!spritefile)
-        quit("Cannot open %s!\n", filename);
-    LatchData = (uint8_t *) malloc(EgaHead->LatchPlaneSize * 4);
-    SpriteData = (uint8_t *) malloc(EgaHead->SpritePlaneSize * 5);
-    if (!LatchData || !SpriteData)
-        quit("Not enough memory to load latch and sprite data!\n");
-
-    /* Read the latch and sprite data, decompressing it if necessary for Keen 1 */
-    if (EgaHead->Compressed) {
-        fseek(latchfile, 6, SEEK_SET);
-        fseek(spritefile, 6, SEEK_SET);
-        lz_decompress(spritefile, (char *) SpriteData);
-        lz_decompress(latchfile, (char *) LatchData);
-    } else {
-        fread(LatchData, EgaHead->LatchPlaneSize * 4, 1, latchfile);
-        fread(SpriteData, EgaHead->SpritePlaneSize * 5, 1, spritefile);
-    }
-
     fclose(headfile);
-    fclose(latchfile);
-    fclose(spritefile);
+
+    /* The latch and sprite data are read when first needed */
+    LatchData = NULL;
+    SpriteData = NULL;
 
     ExportInitialised = 1;
 }
@@ -276,6 +382,7 @@ void k123_export_bitmaps() {
 
     if (!ExportInitialised)
         quit("Trying to export bitmaps before initialisation!");
+    k123_export_load_latch();
 
     /* Export all the bitmaps */
     do_output("Exporting bitmaps");
@@ -287,7 +394,7 @@ void k123_export_bitmaps() {
         /* Decode the bitmap data */
         for (p = 0; p < 4; p++) {
             /* Create a 1bpp bitmap for each plane */
-            planes[p] = bmp256_create(BmpHead[i].Width * 8, BmpHead[i].Height, 1);
+            planes[p] = bmp256_create_ex(BmpHead[i].Width * 8, BmpHead[i].Height, 1, BMP256_POOLED);
 
             /* Decode the lines of the bitmap data */
             pointer = LatchData + EgaHead->OffBitmaps + BmpHead[i].Offset + p * EgaHead->LatchPlaneSize;
@@ -296,7 +403,7 @@ void k123_export_bitmaps() {
         }
 
         /* Create the bitmap file */
-        sprintf(filename, "%s/%s_pic_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+        sprintf(filename, "%s/%s_pic_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
         bmp = bmp256_merge_ex(planes, 4, 4);
         if (!bmp256_save(bmp, filename, Switches->Backup))
             quit("Can't open bitmap file %s!", filename);
@@ -321,6 +428,7 @@ void k123_export_sprites() {
 
     if (!ExportInitialised)
         quit("Trying to export sprites before initialisation!");
+    k123_export_load_sprites();
 
     /* Export all the sprites */
     do_output("Exporting sprites");
@@ -333,13 +441,13 @@ void k123_export_sprites() {
 
         /* Construct the sprite bitmap */
         sprhead = &SprHead[i * 4];
-        spr = bmp256_create(sprhead->Width * 8 * granularity, sprhead->Height,
-                Switches->SeparateMask ? 4 : 8);
+        spr = bmp256_create_ex(sprhead->Width * 8 * granularity, sprhead->Height,
+                Switches->SeparateMask ? 4 : 8, BMP256_POOLED);
 
         /* Decode the sprite color plane and mask data */
         for (p = 0; p < 5; p++) {
             /* Create a 1bpp bitmap for each plane */
-            planes[p] = bmp256_create(sprhead->Width * 8, sprhead->Height, 1);
+            planes[p] = bmp256_create_ex(sprhead->Width * 8, sprhead->Height, 1, BMP256_POOLED);
 
             /* Decode the lines of the image data */
             pointer = SpriteData + EgaHead->OffSprites + sprhead->OffsetParas * 16 + sprhead->OffsetDelta + p * EgaHead->SpritePlaneSize;
@@ -363,7 +471,7 @@ void k123_export_sprites() {
                 bmp->width * (granularity - 1) + (sprhead->Rx2 >> 8), (sprhead->Ry2 >> 8), 12);
 
         /* Create the bitmap file */
-        sprintf(filename, "%s/%s_sprite_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+        sprintf(filename, "%s/%s_sprite_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
         if (!bmp256_save(spr, filename, Switches->Backup))
             quit("Can't open bitmap file %s!", filename);
 
@@ -386,6 +494,7 @@ void k123_export_tiles() {
 
     if (!ExportInitialised)
         quit("Trying to export tiles before initialisation!");
+    k123_export_load_latch();
 
     /* Export all the 16x16 tiles into one bitmap */
     do_output("Exporting tiles");
@@ -398,7 +507,7 @@ void k123_export_tiles() {
 
         for (p = 0; p < 4; p++) {
             /* Create a 1bpp bitmap for each plane */
-            planes[p] = bmp256_create(16, 16, 1);
+            planes[p] = bmp256_create_ex(16, 16, 1, BMP256_POOLED);
 
             pointer = LatchData + EgaHead->Off16Tiles + i * 32 + p * EgaHead->LatchPlaneSize;
             for (y = 0; y < 16; y++)
@@ -419,7 +528,7 @@ void k123_export_tiles() {
     completemsg();
 
     /* Save the bitmap */
-    sprintf(filename, "%s/%s_tile16.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+    sprintf(filename, "%s/%s_tile16.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
     if (!bmp256_save(tiles, filename, Switches->Backup))
         quit("Can't open bitmap file %s!", filename);
     bmp256_free(tiles);
@@ -433,6 +542,7 @@ void k123_export_fonts() {
 
     if (!ExportInitialised)
         quit("Trying to export font before initialisation!");
+    k123_export_load_latch();
 
     /* Export all the 8x8 tiles into one bitmap */
     do_output("Exporting font");
@@ -445,7 +555,7 @@ void k123_export_fonts() {
 
         for (p = 0; p < 4; p++) {
             /* Create a 1bpp bitmap for each plane */
-            planes[p] = bmp256_create(8, 8, 1);
+            planes[p] = bmp256_create_ex(8, 8, 1, BMP256_POOLED);
 
             pointer = LatchData + EgaHead->Off8Tiles + i * 8 + p * EgaHead->LatchPlaneSize;
             for (y = 0; y < 8; y++)
@@ -466,7 +576,7 @@ void k123_export_fonts() {
     completemsg();
 
     /* Save the bitmap */
-    sprintf(filename, "%s/%s_font.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+    sprintf(filename, "%s/%s_font.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
     if (!bmp256_save(font, filename, Switches->Backup))
         quit("Can't open bitmap file %s!", filename);
     bmp256_free(font);
@@ -489,7 +599,7 @@ void k123_export_external() {
         out_filename = (char*) malloc(sizeof (char) * PATH_MAX);
 
         sprintf(in_filename, "%s/%s.%s", Switches->InputPath, ep->Name, EpisodeInfo.GameExt);
-        sprintf(out_filename, "%s/%s_extern_%s.bmp", Switches->OutputPath, EpisodeInfo.GameExt, ep->Name);
+        sprintf(out_filename, "%s/%s_extern_%s.%s", Switches->OutputPath, EpisodeInfo.GameExt, ep->Name, Switches->ImageExt);
 
         if (fin_to_bmp(in_filename, out_filename))
             quit("\nCouldn't convert %s to %s!", in_filename, out_filename);
@@ -505,21 +615,26 @@ void k123_export_end() {
     if (!ExportInitialised)
         quit("Tried to end export before beginning it!");
 
-    free(LatchData);
+    k123_export_free_latch();
     free(SpriteData);
+    SpriteData = NULL;
     free(BmpHead);
     free(SprHead);
     free(EgaHead);
+    bmp256_pool_flush();
 
     ExportInitialised = 0;
 }
 
 void do_k123_export(SwitchStruct *switches) {
     k123_export_begin(switches);
+    /* Everything from the latch data comes first, so it can be freed
+     * before the sprite data is loaded */
     k123_export_bitmaps();
-    k123_export_sprites();
     k123_export_tiles();
     k123_export_fonts();
+    k123_export_free_latch();
+    k123_export_sprites();
     k123_export_external();
     k123_export_end();
 }
@@ -535,6 +650,9 @@ void k123_import_begin(SwitchStruct *switches) {
     int i;
     unsigned sprgranularity;
     uint32_t size;
+    FILE *headfile;
+    EgaHeadStruct oldhead;
+    int compressed = 0;
 
     /* Never allow the import start to occur more than once */
     if (ImportInitialised)
@@ -548,17 +666,25 @@ void k123_import_begin(SwitchStruct *switches) {
     if (!EgaHead)
         quit("Not enough memory to create header");
 
+    /* Keep the latch and sprite data compressed if it already was */
+    sprintf(filename, "%s/egahead.%s", Switches->InputPath, EpisodeInfo.GameExt);
+    if ((headfile = fopen(filename, "rb")) != NULL) {
+        if (fread(&oldhead, sizeof (EgaHeadStruct), 1, headfile) == 1)
+            compressed = oldhead.Compressed != 0;
+        fclose(headfile);
+    }
+
     /* Read the font bitmap */
-    sprintf(filename, "%s/%s_font.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-    FontBmp = bmp256_load(filename);
+    sprintf(filename, "%s/%s_font.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+    FontBmp = bmp256_load_ex(filename, 4, 16);
     if (!FontBmp)
         quit("Can't open font bitmap %s!", filename);
     if (FontBmp->width != 128)
         quit("Font bitmap %s is not 128 pixels wide!", filename);
 
     /* Read the tile bitmap */
-    sprintf(filename, "%s/%s_tile16.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-    TileBmp = bmp256_load(filename);
+    sprintf(filename, "%s/%s_tile16.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+    TileBmp = bmp256_load_ex(filename, 4, 16);
     if (!TileBmp)
         quit("Can't open tile bitmap %s!", filename);
     if (TileBmp->width != 13 * 16)
@@ -569,8 +695,8 @@ void k123_import_begin(SwitchStruct *switches) {
     if (!BitmapBmp)
         quit("Not enough memory to create bitmaps!");
     for (i = 0; i < EpisodeInfo.NumBitmaps; i++) {
-        sprintf(filename, "%s/%s_pic_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-        BitmapBmp[i] = bmp256_load(filename);
+        sprintf(filename, "%s/%s_pic_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+        BitmapBmp[i] = bmp256_load_ex(filename, 4, 16);
         if (!BitmapBmp[i])
             quit("Can't open bitmap %s!", filename);
         if (BitmapBmp[i]->width % 8 != 0)
@@ -583,8 +709,9 @@ void k123_import_begin(SwitchStruct *switches) {
     if (!SpriteBmp)
         quit("Not enough memory to create sprites!");
     for (i = 0; i < EpisodeInfo.NumSprites; i++) {
-        sprintf(filename, "%s/%s_sprite_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-        SpriteBmp[i] = bmp256_load(filename);
+        sprintf(filename, "%s/%s_sprite_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+        SpriteBmp[i] = Switches->SeparateMask ? bmp256_load_ex(filename, 4, 16) :
+                bmp256_load_ex(filename, 8, 32);
         if (!SpriteBmp[i])
             quit("Can't open sprite bitmap %s!", filename);
         if (SpriteBmp[i]->width % (sprgranularity * 8) != 0)
@@ -628,7 +755,7 @@ void k123_import_begin(SwitchStruct *switches) {
     EgaHead->OffBitmapTable = sizeof (EgaHeadStruct);
     EgaHead->NumSprites = EpisodeInfo.NumSprites;
     EgaHead->OffSpriteTable = EgaHead->OffBitmapTable + EgaHead->NumBitmaps * sizeof (BitmapHeadStruct);
-    EgaHead->Compressed = 0;
+    EgaHead->Compressed = compressed;
 
     LatchData = (uint8_t *) malloc(EgaHead->LatchPlaneSize * 4);
     SpriteData = (uint8_t *) malloc(EgaHead->SpritePlaneSize * 5);
@@ -683,7 +810,8 @@ void k123_import_bitmaps() {
 
 void k123_import_sprites() {
     BITMAP256 *bmp, *planes[5];
-    int i, j, p, y, x;
+    BMP256_GETTER get;
+    int i, j, p, y, x, maskx;
     uint8_t *pointer;
     unsigned granularity;
     uint32_t offset;
@@ -709,12 +837,15 @@ void k123_import_sprites() {
         sprhead->OffsetDelta = offset % 16;
         sprhead->OffsetParas = offset / 16;
 
+        /* The clipping rectangle is drawn in the rightmost part */
+        get = bmp256_getter(SpriteBmp[i]->bpp);
+        maskx = SpriteBmp[i]->width / granularity * (granularity - 1);
+
         /* Work out top-left corner of the clipping rectangle */
         x = y = 0;
         for (y = 0; y < SpriteBmp[i]->height; y++)
             for (x = 0; x < SpriteBmp[i]->width / granularity; x++)
-                if (bmp256_getpixel(SpriteBmp[i],
-                        SpriteBmp[i]->width / granularity * (granularity - 1) + x, y) == 12)
+                if (get(SpriteBmp[i]->lines[y], maskx + x) == 12)
                     goto foundtl;
 foundtl:
         sprhead->Rx1 = x << 8;
@@ -724,8 +855,7 @@ foundtl:
         x = y = 0;
         for (y = SpriteBmp[i]->height - 1; y >= 0; y--)
             for (x = SpriteBmp[i]->width / granularity - 1; x >= 0; x--)
-                if (bmp256_getpixel(SpriteBmp[i],
-                        SpriteBmp[i]->width / granularity * (granularity - 1) + x, y) == 12)
+                if (get(SpriteBmp[i]->lines[y], maskx + x) == 12)
                     goto foundbr;
 foundbr:
         sprhead->Rx2 = x << 8;
@@ -749,14 +879,14 @@ foundbr:
         offset += sprhead->Width * sprhead->Height;
 
         /* Copy the sprite image and split it up into planes */
-        bmp = bmp256_create(SpriteBmp[i]->width / granularity,
-                SpriteBmp[i]->height, 8);
+        bmp = bmp256_create_ex(SpriteBmp[i]->width / granularity,
+                SpriteBmp[i]->height, 8, BMP256_POOLED);
         bmp256_blit(SpriteBmp[i], 0, 0, bmp, 0, 0, bmp->width, bmp->height);
 
         /* Get the mask data from the bitmap */
         if (Switches->SeparateMask) {
             bmp256_split_ex(bmp, planes, 0, 4);
-            planes[4] = bmp256_create(bmp->width, bmp->height, 1);
+            planes[4] = bmp256_create_ex(bmp->width, bmp->height, 1, BMP256_POOLED);
             bmp256_blit(SpriteBmp[i], bmp->width, 0, planes[4], 0, 0, bmp->width, bmp->height);
         } else {
             bmp256_split_ex(bmp, planes, 0, 5);
@@ -799,7 +929,7 @@ void k123_import_tiles() {
         showprogress((i * 100) / EgaHead->Num16Tiles);
 
         /* Copy the tile into the small bitmap and split it up into planes */
-        bmp = bmp256_create(16, 16, 4);
+        bmp = bmp256_create_ex(16, 16, 4, BMP256_POOLED);
         bmp256_blit(TileBmp, (i % 13) * 16, (i / 13) * 16, bmp, 0, 0, 16, 16);
         bmp256_split_ex(bmp, planes, 0, 4);
 
@@ -832,7 +962,7 @@ void k123_import_fonts() {
 
     for (i = 0; i < EgaHead->Num8Tiles; i++) {
         /* Copy the character into the small bitmap and split it up into planes */
-        bmp = bmp256_create(8, 8, 4);
+        bmp = bmp256_create_ex(8, 8, 4, BMP256_POOLED);
         bmp256_blit(FontBmp, (i % 16) * 8, (i / 16) * 8, bmp, 0, 0, 8, 8);
         bmp256_split_ex(bmp, planes, 0, 4);
 
@@ -867,7 +997,7 @@ void k123_import_external() {
         in_filename = (char*) malloc(sizeof (char) * PATH_MAX);
         out_filename = (char*) malloc(sizeof (char) * PATH_MAX);
 
-        sprintf(in_filename, "%s/%s_extern_%s.bmp", Switches->OutputPath, EpisodeInfo.GameExt, ep->Name);
+        sprintf(in_filename, "%s/%s_extern_%s.%s", Switches->OutputPath, EpisodeInfo.GameExt, ep->Name, Switches->ImageExt);
         sprintf(out_filename, "%s/%s.%s", Switches->InputPath, ep->Name, EpisodeInfo.GameExt);
 
         if (bmp_to_fin(in_filename, out_filename))
@@ -880,6 +1010,30 @@ void k123_import_external() {
     completemsg();
 }
 
+/* Compress inlen bytes at pin and write them to f as a Keen 1 LZ file: the
+ * decompressed length (32 bits) and two zero bytes, then the LZ data */
+static void k123_compress_file(FILE *f, char *name, uint8_t *pin, uint32_t inlen) {
+    LZContext *ctx;
+    uint8_t *compdata;
+    long complen;
+
+    compdata = (uint8_t *) malloc(6 + LZ_COMPRESS_BOUND(inlen));
+    ctx = lz_ctx_create();
+    if (!compdata || !ctx)
+        quit("Not enough memory to compress %s!", name);
+
+    memcpy(compdata, &inlen, 4);
+    compdata[4] = compdata[5] = 0;
+    complen = lz_ctx_compress(ctx, pin, inlen, compdata + 6, LZ_COMPRESS_BOUND(inlen));
+    if (complen < 0)
+        quit("Unable to compress %s!", name);
+    if (fwrite(compdata, 6 + complen, 1, f) != 1)
+        quit("Unable to write %s!", name);
+
+    lz_ctx_free(ctx);
+    free(compdata);
+}
+
 void k123_import_end() {
     int i;
     FILE *headfile, *latchfile, *spritefile;
@@ -910,7 +1064,10 @@ void k123_import_end() {
     latchfile = openfile(filename, "wb", Switches->Backup);
     if (!latchfile)
         quit("Can't open %s for writing!", filename);
-    fwrite(LatchData, EgaHead->LatchPlaneSize * 4, 1, latchfile);
+    if (EgaHead->Compressed)
+        k123_compress_file(latchfile, "EGALATCH", LatchData, EgaHead->LatchPlaneSize * 4);
+    else
+        fwrite(LatchData, EgaHead->LatchPlaneSize * 4, 1, latchfile);
     fclose(latchfile);
 
     /* Write the sprite file */
@@ -918,7 +1075,10 @@ void k123_import_end() {
     spritefile = openfile(filename, "wb", Switches->Backup);
     if (!spritefile)
         quit("Can't open %s for writing!", filename);
-    fwrite(SpriteData, EgaHead->SpritePlaneSize * 5, 1, spritefile);
+    if (EgaHead->Compressed)
+        k123_compress_file(spritefile, "EGASPRIT", SpriteData, EgaHead->SpritePlaneSize * 5);
+    else
+        fwrite(SpriteData, EgaHead->SpritePlaneSize * 5, 1, spritefile);
     fclose(spritefile);
 
 
@@ -932,6 +1092,7 @@ void k123_import_end() {
     bmp256_free(TileBmp);
     bmp256_free(FontBmp);
     free(EgaHead);
+    bmp256_pool_flush();
 
     ImportInitialised = 0;
 }
@@ -986,8 +1147,8 @@ int fin_to_bmp(char *finfile, char *bmpfile) {
         /* Draw buffered bits */
         for (i = 0; i < bytecount; i++) {
             for (bitmask = 0x80; bitmask > 0; bitmask >>= 1) {
-                if (bytes[i] & bitmask)
-                    bmp256_putpixel(bmp, x, y, bmp256_getpixel(bmp, x, y) | plane);
+                if ((bytes[i] & bitmask) && y < 200)
+                    BMP256_PUT4(bmp->lines[y], x, BMP256_GET4(bmp->lines[y], x) | plane);
                 x++;
                 if (x >= 320) {
                     x = 0;
@@ -1022,7 +1183,7 @@ int bmp_to_fin(char *bmpfile, char *finfile) {
     FILE *fout;
     BITMAP256 *bmp;
     /* Load the bmp, and make sure it's the right size */
-    bmp = bmp256_load(bmpfile);
+    bmp = bmp256_load_ex(bmpfile, 4, 16);
     if (!bmp) {
         do_output("BMP2FIN: Can't find input bitmap, or not 16 colours!\n");
         return 1;
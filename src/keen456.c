@@ -27,6 +27,7 @@
 #include <limits.h>
 #include <memory.h>
 #include <assert.h>
+#include <time.h>
 
 #include "bmp256.h"
 #include "huff.h"
@@ -129,6 +130,7 @@ static BitmapHeadStruct *BmpHead = NULL;
 static BitmapHeadStruct *BmpMaskedHead = NULL;
 static SpriteHeadStruct *SprHead = NULL;
 static SwitchStruct *Switches = NULL;
+static HuffContext *HuffDict = NULL;
 static MiscInfoList *MiscInfos = NULL;
 
 /* A buffer for file-defined episodes */
@@ -524,6 +526,65 @@ static void k456_set_sparse_tiles_ptrs(void) {
 
 /************************************************************************************************************/
 
+/* Time the table-driven Huffman decoder against the reference tree walker over
+ * every chunk of the ?GAGRAPH, and check that both produce identical output */
+static void k456_benchmark_expand(uint8_t *compdata, uint32_t *inoffsets, uint32_t *inlens) {
+	int i, pass, mismatches = 0;
+	uint32_t maxlen = 0;
+	unsigned long total = 0;
+	uint8_t *scratch;
+	clock_t start;
+	double treetime, tabletime;
+
+	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
+		if (EgaGraph[i].len > maxlen)
+			maxlen = EgaGraph[i].len;
+		total += EgaGraph[i].len;
+	}
+	if (!total)
+		return;
+
+	scratch = (uint8_t *) malloc(maxlen);
+	if (!scratch)
+		quit("Not enough memory to benchmark %sGRAPH decompression!", EpisodeInfo.GraphicsFormat);
+
+	/* The chunks were already expanded with huff_ctx_expand; compare against the reference */
+	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
+		if (!EgaGraph[i].data)
+			continue;
+		huff_ctx_expand_tree(HuffDict, compdata + inoffsets[i], scratch, inlens[i], EgaGraph[i].len);
+		if (memcmp(scratch, EgaGraph[i].data, EgaGraph[i].len)) {
+			setcol_error;
+			do_output("Decoder mismatch in %sGRAPH chunk %d!\n", EpisodeInfo.GraphicsFormat, i);
+			setcol_normal;
+			mismatches++;
+		}
+	}
+
+	start = clock();
+	for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+		for (i = 0; i < EpisodeInfo.NumChunks; i++)
+			if (EgaGraph[i].data)
+				huff_ctx_expand_tree(HuffDict, compdata + inoffsets[i], scratch, inlens[i], EgaGraph[i].len);
+	treetime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+		for (i = 0; i < EpisodeInfo.NumChunks; i++)
+			if (EgaGraph[i].data)
+				huff_ctx_expand(HuffDict, compdata + inoffsets[i], scratch, inlens[i], EgaGraph[i].len);
+	tabletime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	free(scratch);
+
+	do_output("Huffman decode benchmark (%lu bytes x %d passes):\n", total, BENCHMARK_PASSES);
+	benchmark_line("Tree walk:", treetime, total, 0);
+	benchmark_line("Table lookup:", tabletime, total, treetime);
+	if (mismatches)
+		quit("Table-driven decoder disagreed with the reference on %d chunks!", mismatches);
+}
+
+
 
 void k456_export_begin(SwitchStruct *switches) {
 	char filename[PATH_MAX];
@@ -533,6 +594,7 @@ void k456_export_begin(SwitchStruct *switches) {
 	uint8_t *CompEgaGraphData;
 	uint32_t *EgaHead = NULL;
 	uint32_t egagraphlen, inlen, outlen;
+	uint32_t *inoffsets = NULL, *inlens = NULL;
 	int i, j;
 	uint32_t grstart_mask;
 	char graphicsformat[4];
@@ -617,7 +679,11 @@ void k456_export_begin(SwitchStruct *switches) {
 		filetoread = exefile;
 		offset = exeheaderlen + EpisodeInfo.OffEgaDict;
 	}
-	huff_read_dictionary(filetoread, offset);
+	HuffDict = huff_ctx_create();
+	if (!HuffDict)
+		quit("Not enough memory to read %sDICT!", EpisodeInfo.GraphicsFormat);
+	if (!huff_ctx_read_dictionary(HuffDict, filetoread, offset))
+		quit("%sDICT is not a valid Huffman dictionary!", EpisodeInfo.GraphicsFormat);
 
 	/* Get the ?GAHEAD Data */
 	EgaHead = malloc(EpisodeInfo.NumChunks * sizeof (uint32_t));
@@ -679,6 +745,13 @@ void k456_export_begin(SwitchStruct *switches) {
 	EgaGraph = (ChunkStruct *) malloc(EpisodeInfo.NumChunks * sizeof (ChunkStruct));
 	if (!EgaGraph)
 		quit("Not enough memory to decompress %sGRAPH!", EpisodeInfo.GraphicsFormat);
+	if (Switches->Benchmark) {
+		/* Remember where each chunk's compressed data is so it can be decoded again */
+		inoffsets = (uint32_t *) calloc(EpisodeInfo.NumChunks, sizeof (uint32_t));
+		inlens = (uint32_t *) calloc(EpisodeInfo.NumChunks, sizeof (uint32_t));
+		if (!inoffsets || !inlens)
+			quit("Not enough memory to benchmark %sGRAPH decompression!", EpisodeInfo.GraphicsFormat);
+	}
 	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
 		/* Show that something is happening */
 		showprogress((int) ((i * 100) / EpisodeInfo.NumChunks));
@@ -751,7 +824,11 @@ void k456_export_begin(SwitchStruct *switches) {
 				setcol_normal;
 				gotoxy(0, wherey() - 1);
 			}
-			huff_expand(CompEgaGraphData + offset, EgaGraph[i].data, inlen, outlen);
+			huff_ctx_expand(HuffDict, CompEgaGraphData + offset, EgaGraph[i].data, inlen, outlen);
+			if (inoffsets) {
+				inoffsets[i] = offset;
+				inlens[i] = inlen;
+			}
 
 		} else {
 			EgaGraph[i].len = 0;
@@ -768,6 +845,12 @@ void k456_export_begin(SwitchStruct *switches) {
 		gotoxy(0, wherey() + 1);
 	}
 
+	if (Switches->Benchmark) {
+		k456_benchmark_expand(CompEgaGraphData, inoffsets, inlens);
+		free(inoffsets);
+		free(inlens);
+	}
+
 	/* Set up pointers to bitmap and sprite tables if said data type exists */
 	if (EpisodeInfo.NumBitmaps > 0)
 		BmpHead = (BitmapHeadStruct *) EgaGraph[EpisodeInfo.IndexBitmapTable].data;
@@ -798,6 +881,10 @@ void k456_export_end() {
 
 	free(EgaGraph);
 
+	huff_ctx_free(HuffDict);
+	HuffDict = NULL;
+	bmp256_pool_flush();
+
 	ExportInitialised = 0;
 }
 
@@ -840,28 +927,31 @@ void k456_export_bitmaps() {
 			}
 
 
-			/* Decode the bitmap data */
-			for (p = 0; p < numofplanes; p++) {
+			if (strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
+				/* Decode the bitmap data */
+				for (p = 0; p < numofplanes; p++) {
 
-				/* Create a bitmap for each plane */
-				planes[p] = bmp256_create(planewidth, BmpHead[i].Height, planebpp);
-				if (!planes[p])
-					quit("Not enough memory to create unmasked pictures!");
+					/* Create a bitmap for each plane */
+					planes[p] = bmp256_create_ex(planewidth, BmpHead[i].Height, planebpp, BMP256_POOLED);
+					if (!planes[p])
+						quit("Not enough memory to create unmasked pictures!");
 
-				/* Decode the lines of the bitmap data */
-				pointer = EgaGraph[EpisodeInfo.IndexBitmaps + i].data + p * linewidth * BmpHead[i].Height;
-				for (y = 0; y < BmpHead[i].Height; y++)
-					memcpy(planes[p]->lines[y], pointer + y * linewidth, linewidth);
+					/* Decode the lines of the bitmap data */
+					pointer = EgaGraph[EpisodeInfo.IndexBitmaps + i].data + p * linewidth * BmpHead[i].Height;
+					for (y = 0; y < BmpHead[i].Height; y++)
+						memcpy(planes[p]->lines[y], pointer + y * linewidth, linewidth);
+				}
 			}
 
 			/* Create the bitmap file */
-			sprintf(filename, "%s/%s_pic_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+			sprintf(filename, "%s/%s_pic_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
 			if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
-				bmp = bmp256_demunge(planes, 4, 8);
+				/* VGA planes are interleaved straight from the chunk */
+				bmp = bmp256_demunge_planar(EgaGraph[EpisodeInfo.IndexBitmaps + i].data, planewidth, BmpHead[i].Height, numofplanes);
 			} else if (!strcmp(EpisodeInfo.GraphicsFormat, "EGA")) {
 				bmp = bmp256_merge_ex(planes, 4, 4);
 			} else {
-				bmp = bmp256_create(planewidth, BmpHead[i].Height, 4); // 2bpp bmps aren't widely supported
+				bmp = bmp256_create_ex(planewidth, BmpHead[i].Height, 4, BMP256_POOLED); // 2bpp bmps aren't widely supported
 				bmp256_blit(planes[0], 0, 0, bmp, 0, 0, planewidth, BmpHead[i].Height);
 			}
 
@@ -871,8 +961,10 @@ void k456_export_bitmaps() {
 				quit("Can't open bitmap file %s!", filename);
 
 			/* Free the memory used */
-			for (p = 0; p < numofplanes; p++) {
-				bmp256_free(planes[p]);
+			if (strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
+				for (p = 0; p < numofplanes; p++) {
+					bmp256_free(planes[p]);
+				}
 			}
 			bmp256_free(bmp);
 		}
@@ -903,27 +995,11 @@ void k456_export_masked_bitmaps() {
 
 			if (EgaGraph[EpisodeInfo.IndexMaskedBitmaps + i].data) {
 
-				linewidth = planewidth = BmpMaskedHead[i].Width/4;
-				planebpp = 8;
-
-
-				/* Decode the bitmap data */
-				for (p = 0; p < 4; p++) {
-
-					/* Create a bitmap for each plane */
-					planes[p] = bmp256_create(planewidth, BmpMaskedHead[i].Height, planebpp);
-					if (!planes[p])
-						quit("Not enough memory to create masked pictures!");
-
-					/* Decode the lines of the bitmap data */
-					pointer = EgaGraph[EpisodeInfo.IndexMaskedBitmaps + i].data + p * linewidth * BmpMaskedHead[i].Height;
-					for (y = 0; y < BmpMaskedHead[i].Height; y++)
-						memcpy(planes[p]->lines[y], pointer + y * linewidth, linewidth);
-				}
+				planewidth = BmpMaskedHead[i].Width/4;
 
-				/* Create the bitmap file */
-				sprintf(filename, "%s/%s_picm_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-				bmp = bmp256_demunge(planes, 4, 8);
+				/* Create the bitmap file, interleaving the planes straight from the chunk */
+				sprintf(filename, "%s/%s_picm_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+				bmp = bmp256_demunge_planar(EgaGraph[EpisodeInfo.IndexMaskedBitmaps + i].data, planewidth, BmpMaskedHead[i].Height, 4);
 
 				if (!bmp)
 					quit("Not enough memory to create masked pictures!");
@@ -931,9 +1007,6 @@ void k456_export_masked_bitmaps() {
 					quit("Can't open bitmap file %s!", filename);
 
 				/* Free the memory used */
-				for (p = 0; p < 4; p++) {
-					bmp256_free(planes[p]);
-				}
 				bmp256_free(bmp);
 			}
 		}
@@ -963,7 +1036,7 @@ void k456_export_masked_bitmaps() {
 				/* Decode the mask and color plane data */
 				for (p = 0; p < totalnumofplanes; p++) {
 					/* Create a bitmap for each plane */
-					planes[p] = bmp256_create(planewidth, BmpMaskedHead[i].Height, planebpp);
+					planes[p] = bmp256_create_ex(planewidth, BmpMaskedHead[i].Height, planebpp, BMP256_POOLED);
 
 					/* Decode the lines of the bitmap data */
 					pointer = EgaGraph[EpisodeInfo.IndexMaskedBitmaps + i].data + ((p + 1) % totalnumofplanes) * linewidth * BmpMaskedHead[i].Height;
@@ -973,7 +1046,7 @@ void k456_export_masked_bitmaps() {
 
 				if (Switches->SeparateMask) {
 					/* Draw the color planes and mask separately */
-					mbmp = bmp256_create(planewidth * 2, BmpMaskedHead[i].Height, 4);
+					mbmp = bmp256_create_ex(planewidth * 2, BmpMaskedHead[i].Height, 4, BMP256_POOLED);
 					bmp256_blit(planes[totalnumofplanes-1], 0, 0, mbmp, planewidth, 0, planewidth, BmpMaskedHead[i].Height);
 					bmp = bmp256_merge_ex(planes, totalnumofplanes-1, 4);
 					bmp256_blit(bmp, 0, 0, mbmp, 0, 0, planewidth, BmpMaskedHead[i].Height);
@@ -984,7 +1057,7 @@ void k456_export_masked_bitmaps() {
 				}
 
 				/* Create the bitmap file */
-				sprintf(filename, "%s/%s_picm_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+				sprintf(filename, "%s/%s_picm_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
 				if (!bmp256_save(mbmp, filename, Switches->Backup))
 					quit("Can't open bitmap file %s!", filename);
 
@@ -1036,9 +1109,10 @@ void k456_export_tiles() {
 
 	tiles = bmp256_create(16 * 18, 16 * ((EpisodeInfo.Num16Tiles + 17) / 18), outbpp);
 
-	/* Create a bitmap for each plane */
-	for (p = 0; p < numofplanes; p++)
-		planes[p] = bmp256_create(planewidth, 16, planebpp);
+	/* Create a bitmap for each plane; VGA tiles are interleaved without them */
+	if (strcmp(EpisodeInfo.GraphicsFormat, "VGA"))
+		for (p = 0; p < numofplanes; p++)
+			planes[p] = bmp256_create(planewidth, 16, planebpp);
 
 	for (i = 0; i < EpisodeInfo.Num16Tiles; i++) {
 		/* Show that something is happening */
@@ -1051,17 +1125,17 @@ void k456_export_tiles() {
 			}
 			indata = Sparse16TilePtr;
 		}
-		/* Decode the image data */
-		for (p = 0; p < numofplanes; p++) {
-			/* Decode the lines of the bitmap data */
-			pointer = indata + p * linewidth * 16;
-			for (y = 0; y < 16; y++)
-				memcpy(planes[p]->lines[y], pointer + y * linewidth, linewidth);
-		}
-
 		if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
-			bmp = bmp256_demunge(planes, 4, 8);
+			/* VGA planes are interleaved straight from the chunk */
+			bmp = bmp256_demunge_planar(indata, planewidth, 16, numofplanes);
 		} else {
+			/* Decode the image data */
+			for (p = 0; p < numofplanes; p++) {
+				/* Decode the lines of the bitmap data */
+				pointer = indata + p * linewidth * 16;
+				for (y = 0; y < 16; y++)
+					memcpy(planes[p]->lines[y], pointer + y * linewidth, linewidth);
+			}
 			bmp = bmp256_merge_ex(planes, numofplanes, 4);
 		}
 		bmp256_blit(bmp, 0, 0, tiles, 16 * (i % 18), 16 * (i / 18), 16, 16);
@@ -1070,13 +1144,14 @@ void k456_export_tiles() {
 	completemsg();
 
 	/* Create the bitmap file */
-	sprintf(filename, "%s/%s_tile16.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+	sprintf(filename, "%s/%s_tile16.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
 	if (!bmp256_save(tiles, filename, Switches->Backup))
 		quit("Can't open bitmap file %s!", filename);
 
 	/* Free the memory used */
-	for (p = 0; p < numofplanes; p++)
-		bmp256_free(planes[p]);
+	if (strcmp(EpisodeInfo.GraphicsFormat, "VGA"))
+		for (p = 0; p < numofplanes; p++)
+			bmp256_free(planes[p]);
 	bmp256_free(tiles);
 }
 
@@ -1157,7 +1232,7 @@ void k456_export_masked_tiles() {
 	completemsg();
 
 	/* Create the bitmap file */
-	sprintf(filename, "%s/%s_tile16m.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+	sprintf(filename, "%s/%s_tile16m.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
 	if (!bmp256_save(tiles, filename, Switches->Backup))
 		quit("Can't open bitmap file %s!", filename);
 
@@ -1232,7 +1307,7 @@ void k456_export_8_tiles() {
 		}
 
 		/* Create the bitmap file */
-		sprintf(filename, "%s/%s_tile8.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+		sprintf(filename, "%s/%s_tile8.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
 		if (!bmp256_save(tiles, filename, Switches->Backup))
 			quit("Can't open bitmap file %s!", filename);
 
@@ -1290,7 +1365,7 @@ void k456_export_8_masked_tiles() {
 		completemsg();
 
 		/* Create the bitmap file */
-		sprintf(filename, "%s/%s_tile8m.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+		sprintf(filename, "%s/%s_tile8m.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
 		if (!bmp256_save(tiles, filename, Switches->Backup))
 			quit("Can't open bitmap file %s!", filename);
 
@@ -1349,7 +1424,7 @@ void k456_export_8_masked_tiles() {
 		}
 
 		/* Create the bitmap file */
-		sprintf(filename, "%s/%s_tile8m.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
+		sprintf(filename, "%s/%s_tile8m.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
 		if (!bmp256_save(tiles, filename, Switches->Backup))
 			quit("Can't open bitmap file %s!", filename);
 
@@ -1395,7 +1470,7 @@ void k456_export_sprites() {
 
 			if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
 
-				spr = bmp256_create(SprHead[i].Width * 2, SprHead[i].Height, 8);
+				spr = bmp256_create_ex(SprHead[i].Width * 2, SprHead[i].Height, 8, BMP256_POOLED);
 
 				if (!spr)
 					quit("Couldn't create bitmap for sprite %i!\n");
@@ -1403,7 +1478,7 @@ void k456_export_sprites() {
 				/* Decode the sprite mask and color plane data */
 				for (p = 0; p < 4; p++) {
 					/* Create an 8bpp bitmap for each plane */
-					planes[p] = bmp256_create(SprHead[i].Width / 2, SprHead[i].Height, 8);
+					planes[p] = bmp256_create_ex(SprHead[i].Width / 2, SprHead[i].Height, 8, BMP256_POOLED);
 
 					/* Decode the lines of the bitmap data */
 					pointer = EgaGraph[EpisodeInfo.IndexSprites + i].data + p * SprHead[i].Width / 4 * SprHead[i].Height;
@@ -1425,7 +1500,7 @@ void k456_export_sprites() {
 						((SprHead[i].Ry2 - SprHead[i].OrgY) >> 4), 12);
 
 				/* Create the bitmap file */
-				sprintf(filename, "%s/%s_sprite_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+				sprintf(filename, "%s/%s_sprite_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
 				if (!bmp256_save(spr, filename, Switches->Backup))
 					quit("Can't open bitmap file %s!", filename);
 
@@ -1451,9 +1526,9 @@ void k456_export_sprites() {
 
 				/* Now create the sprite bitmap */
 				if (Switches->SeparateMask)
-					spr = bmp256_create(planewidth * 3, SprHead[i].Height, outbpp);
+					spr = bmp256_create_ex(planewidth * 3, SprHead[i].Height, outbpp, BMP256_POOLED);
 				else
-					spr = bmp256_create(planewidth * 2, SprHead[i].Height, outbpp);
+					spr = bmp256_create_ex(planewidth * 2, SprHead[i].Height, outbpp, BMP256_POOLED);
 
 				if (!spr)
 					quit("Couldn't create bitmap for sprite %i!\n");
@@ -1461,7 +1536,7 @@ void k456_export_sprites() {
 				/* Decode the sprite mask and color plane data */
 				for (p = 0; p < totalnumofplanes; p++) {
 					/* Create a bitmap for each plane */
-					planes[p] = bmp256_create(planewidth, SprHead[i].Height, planebpp);
+					planes[p] = bmp256_create_ex(planewidth, SprHead[i].Height, planebpp, BMP256_POOLED);
 
 					/* Decode the lines of the bitmap data */
 					pointer = EgaGraph[EpisodeInfo.IndexSprites + i].data + ((p + 1) % totalnumofplanes) * SprHead[i].Width * SprHead[i].Height;
@@ -1489,7 +1564,7 @@ void k456_export_sprites() {
 						((SprHead[i].Ry2 - SprHead[i].OrgY) >> 4), !strcmp(EpisodeInfo.GraphicsFormat, "EGA") ? 12 : 14);
 
 				/* Create the bitmap file */
-				sprintf(filename, "%s/%s_sprite_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+				sprintf(filename, "%s/%s_sprite_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
 				if (!bmp256_save(spr, filename, Switches->Backup))
 					quit("Can't open bitmap file %s!", filename);
 
@@ -1663,7 +1738,7 @@ void k456_export_fonts() {
 			}
 
 			/* Create the bitmap file */
-			sprintf(filename, "%s/%s_fon_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
+			sprintf(filename, "%s/%s_fon_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
 			if (!bmp256_save(font, filename, Switches->Backup))
 				quit("Can't open bitmap file %s!", filename);
 
@@ -1757,8 +1832,8 @@ void k456_export_terminator_text() {
 					int p;
 
 					/* Write the run of pixels */
-					for (p = 0; p < *rleptr; p++) {
-						bmp256_putpixel(bmp, x + p, y, color);
+					for (p = 0; p < *rleptr && x + p < bmp->width; p++) {
+						BMP256_PUT1(bmp->lines[y], x + p, color);
 					}
 
 					/* Update color and x position */
@@ -1770,7 +1845,7 @@ void k456_export_terminator_text() {
 		}
 
 		/* Create the bitmap file */
-		sprintf(filename, "%s/%s_terminator_%s.bmp", Switches->OutputPath, EpisodeInfo.GameExt, mp->File);
+		sprintf(filename, "%s/%s_terminator_%s.%s", Switches->OutputPath, EpisodeInfo.GameExt, mp->File, Switches->ImageExt);
 		if (!bmp256_save(bmp, filename, Switches->Backup))
 			quit("Can't open bitmap file %s!", filename);
 		bmp256_free(bmp);
@@ -1830,10 +1905,14 @@ void k456_import_begin(SwitchStruct *switches) {
 	strncpy(graphicsformat, EpisodeInfo.GraphicsFormat, 4);
 	strlwr(graphicsformat);
 
+	HuffDict = huff_ctx_create();
+	if (!HuffDict)
+		quit("Not enough memory for %sDICT!", EpisodeInfo.GraphicsFormat);
+
 	/* Read Game archive data */
 	exefile = dictfile = filetoread = NULL;
 
-	if (!Switches->OptimizedComp) {
+	if (!Switches->OptimizedComp || Switches->BestDict) {
 		/* Check for ?GADICT */
 		sprintf(filename, "%s/%sdict.%s", Switches->InputPath, graphicsformat, EpisodeInfo.GameExt);
 		dictfile = fopen(filename, "rb");
@@ -1882,7 +1961,8 @@ void k456_import_begin(SwitchStruct *switches) {
 			filetoread = exefile;
 			offset = exeheaderlen + EpisodeInfo.OffEgaDict;
 		}
-		huff_read_dictionary(filetoread, offset);
+		if (!huff_ctx_read_dictionary(HuffDict, filetoread, offset))
+			quit("%sDICT is not a valid Huffman dictionary!", EpisodeInfo.GraphicsFormat);
 
 		/* Close the files */
 		if (dictfile)
@@ -1926,13 +2006,277 @@ void k456_import_begin(SwitchStruct *switches) {
 	ImportInitialised = 1;
 }
 
+/* Does chunk i get an IGRAB-style "!ID!" signature written before it? */
+static int k456_chunk_has_sig(int i) {
+	if (!Switches->IgrabSig)
+		return 0;
+
+	return ((i == EpisodeInfo.IndexFonts) && EpisodeInfo.NumFonts) ||
+	       ((i == EpisodeInfo.IndexMaskedFonts) && EpisodeInfo.NumMaskedFonts) ||
+	       ((i == EpisodeInfo.IndexBitmaps) && EpisodeInfo.NumBitmaps) ||
+	       ((i == EpisodeInfo.IndexMaskedBitmaps) && EpisodeInfo.NumMaskedBitmaps) || 
+	       ((i == EpisodeInfo.IndexSprites) && EpisodeInfo.NumSprites) || 
+	       ((i == EpisodeInfo.Index8Tiles) && EpisodeInfo.Num8Tiles) || 
+	       ((i == EpisodeInfo.Index8MaskedTiles) && EpisodeInfo.Num8MaskedTiles) || 
+	       ((i == EpisodeInfo.Index16Tiles) && EpisodeInfo.Num16Tiles) || 
+	       ((i == EpisodeInfo.Index16MaskedTiles) && EpisodeInfo.Num16MaskedTiles);
+}
+
+/* Expanded sizes of tile chunks are implicit; all other chunks start with their length */
+static int k456_chunk_has_length(int i) {
+	return i < EpisodeInfo.Index8Tiles || i >= EpisodeInfo.Index32MaskedTiles + EpisodeInfo.Num32MaskedTiles;
+}
+
+/* Size of the ?GAGRAPH, signatures and length prefixes included, if compressed
+ * with ctx (which must be set up for compression). Each chunk's compressed
+ * length is stored if compLens is not NULL. */
+static unsigned long k456_graph_size(HuffContext *ctx, int (*chunkCounts)[256], uint32_t *compLens) {
+	unsigned long graphlen = 0;
+	uint32_t complen;
+	int i;
+
+	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
+		if (k456_chunk_has_sig(i))
+			graphlen += 4;
+		complen = 0;
+		if (EgaGraph[i].data && EgaGraph[i].len > 0) {
+			complen = huff_ctx_compressed_size(ctx, chunkCounts[i], EgaGraph[i].len, Switches->IgrabHuffTrailMode);
+			if (k456_chunk_has_length(i))
+				graphlen += sizeof (uint32_t);
+			graphlen += complen;
+		}
+		if (compLens)
+			compLens[i] = complen;
+	}
+	return graphlen;
+}
+
+/* Build an optimized Huffman dictionary for the given byte counts into ctx.
+ * The code lengths are limited if -maxcodelen asks for it, or if a byte that
+ * is used would otherwise get a code too long to output. */
+static void k456_optimize_dictionary(HuffContext *ctx, int counts[], int report) {
+	int i, len, maxcodelen, maxusedcodelen, codelenlimit;
+	uint64_t unlimitedbits, limitedbits;
+
+	if (!huff_ctx_huffmanize(ctx, counts) || !huff_ctx_setup_compression(ctx))
+		quit("Could not build an optimized %sDICT!", EpisodeInfo.GraphicsFormat);
+
+	/* Find the longest code, both overall and among the bytes we'll output */
+	maxcodelen = maxusedcodelen = 0;
+	for (i = 0; i < 256; ++i) {
+		len = huff_ctx_code_length(ctx, i);
+		if (len > maxcodelen)
+			maxcodelen = len;
+		if (counts[i] && len > maxusedcodelen)
+			maxusedcodelen = len;
+	}
+
+	/* Rebuild a length-limited tree if asked to, or if the codes are too long to output */
+	codelenlimit = 0;
+	if (Switches->MaxCodeLen && maxcodelen > Switches->MaxCodeLen)
+		codelenlimit = Switches->MaxCodeLen;
+	else if (maxusedcodelen > HUFF_MAX_CODE_BITS)
+		codelenlimit = HUFF_MAX_CODE_BITS;
+	if (codelenlimit) {
+		unlimitedbits = huff_ctx_encoded_bits(ctx, counts);
+		if (!huff_ctx_huffmanize_limited(ctx, counts, codelenlimit) || !huff_ctx_setup_compression(ctx))
+			quit("Could not build an optimized %sDICT with %d-bit codes!", EpisodeInfo.GraphicsFormat, codelenlimit);
+		limitedbits = huff_ctx_encoded_bits(ctx, counts);
+		if (report)
+			do_output("Limited %sDICT codes from %d to %d bits: %lu bytes of data become %lu (%+ld)\n",
+					EpisodeInfo.GraphicsFormat, maxcodelen, codelenlimit,
+					(unsigned long)((unlimitedbits + 7) / 8), (unsigned long)((limitedbits + 7) / 8),
+					(long)((limitedbits + 7) / 8) - (long)((unlimitedbits + 7) / 8));
+	}
+}
+
+/* Add the byte counts of chunks first to first + num - 1 to counts */
+static void k456_add_chunk_counts(int counts[], int (*chunkCounts)[256], int first, int num) {
+	int i, j;
+
+	for (i = first; i < first + num && i < EpisodeInfo.NumChunks; i++)
+		for (j = 0; j < 256; j++)
+			counts[j] += chunkCounts[i][j];
+}
+
+#define NUM_DICT_CANDIDATES 4
+
+/* Score the original ?GADICT and several optimized ones by the exact size of
+ * the ?GAGRAPH each would produce, and keep the smallest in HuffDict. Returns
+ * 1 if an optimized dictionary was chosen, or 0 to keep the original. */
+static int k456_choose_dictionary(int byteCounts[], int (*chunkCounts)[256]) {
+	static const char *names[NUM_DICT_CANDIDATES] = {
+		"Original", "Optimized", "Sprite-weighted", "Masked tile-weighted"
+	};
+	HuffContext *candidates[NUM_DICT_CANDIDATES];
+	int counts[256];
+	unsigned long size, bestsize = 0;
+	int i, c, best = -1;
+
+	candidates[0] = HuffDict;
+	for (c = 1; c < NUM_DICT_CANDIDATES; c++) {
+		candidates[c] = NULL;
+
+		/* Weighted candidates count their asset class twice */
+		for (i = 0; i < 256; i++)
+			counts[i] = byteCounts[i];
+		if (c == 2) {
+			if (!EpisodeInfo.NumSprites)
+				continue;
+			k456_add_chunk_counts(counts, chunkCounts, EpisodeInfo.IndexSprites, EpisodeInfo.NumSprites);
+		} else if (c == 3) {
+			if (!EpisodeInfo.Num8MaskedTiles && !EpisodeInfo.Num16MaskedTiles && !EpisodeInfo.Num32MaskedTiles)
+				continue;
+			if (EpisodeInfo.Num8MaskedTiles)
+				k456_add_chunk_counts(counts, chunkCounts, EpisodeInfo.Index8MaskedTiles, 1);
+			k456_add_chunk_counts(counts, chunkCounts, EpisodeInfo.Index16MaskedTiles, EpisodeInfo.Num16MaskedTiles);
+			k456_add_chunk_counts(counts, chunkCounts, EpisodeInfo.Index32MaskedTiles, EpisodeInfo.Num32MaskedTiles);
+		}
+
+		candidates[c] = huff_ctx_create();
+		if (!candidates[c])
+			quit("Not enough memory for candidate %sDICTs!", EpisodeInfo.GraphicsFormat);
+		k456_optimize_dictionary(candidates[c], counts, c == 1);
+	}
+
+	do_output("Choosing %sDICT:\n", EpisodeInfo.GraphicsFormat);
+	for (c = 0; c < NUM_DICT_CANDIDATES; c++) {
+		if (!candidates[c])
+			continue;
+
+		/* The original may not be able to encode the new data at all */
+		if (!huff_ctx_setup_compression(candidates[c])) {
+			do_output("  %-22s cannot encode every byte\n", names[c]);
+			continue;
+		}
+		for (i = 0; i < 256; i++)
+			if (byteCounts[i] && huff_ctx_code_length(candidates[c], i) > HUFF_MAX_CODE_BITS)
+				break;
+		if (i < 256) {
+			do_output("  %-22s has codes that are too long\n", names[c]);
+			continue;
+		}
+
+		size = k456_graph_size(candidates[c], chunkCounts, NULL);
+		do_output("  %-22s %lu bytes\n", names[c], size);
+		if (best < 0 || size < bestsize) {
+			best = c;
+			bestsize = size;
+		}
+	}
+	if (best < 0)
+		quit("None of the candidate %sDICTs can be used!", EpisodeInfo.GraphicsFormat);
+
+	for (c = 0; c < NUM_DICT_CANDIDATES; c++)
+		if (c != best && candidates[c])
+			huff_ctx_free(candidates[c]);
+	HuffDict = candidates[best];
+
+	setcol_success;
+	do_output("Using the %s %sDICT.\n", names[best], EpisodeInfo.GraphicsFormat);
+	setcol_normal;
+	return best != 0;
+}
+
+/* Time the word-at-a-time Huffman encoder against the reference bitwise encoder,
+ * and the histogram kernel against a simple count, over every chunk to be
+ * written, and check that both produce identical output */
+static void k456_benchmark_compress() {
+	int i, j, pass, mismatches = 0;
+	uint32_t k, maxlen = 0;
+	unsigned long total = 0, len1, len2;
+	uint8_t *scratch1, *scratch2;
+	int counts1[256], counts2[256];
+	clock_t start;
+	double bitwisetime, wordtime, simpletime, histtime;
+
+	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
+		if (!EgaGraph[i].data)
+			continue;
+		if (EgaGraph[i].len > maxlen)
+			maxlen = EgaGraph[i].len;
+		total += EgaGraph[i].len;
+	}
+	if (!total)
+		return;
+
+	scratch1 = (uint8_t *) malloc(maxlen * 2);
+	scratch2 = (uint8_t *) malloc(maxlen * 2);
+	if (!scratch1 || !scratch2)
+		quit("Not enough memory to benchmark %sGRAPH compression!", EpisodeInfo.GraphicsFormat);
+
+	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
+		if (!EgaGraph[i].data || !EgaGraph[i].len)
+			continue;
+		len1 = huff_ctx_compress_bitwise(HuffDict, EgaGraph[i].data, scratch1, EgaGraph[i].len, EgaGraph[i].len * 2, Switches->IgrabHuffTrailMode);
+		len2 = huff_ctx_compress(HuffDict, EgaGraph[i].data, scratch2, EgaGraph[i].len, EgaGraph[i].len * 2, Switches->IgrabHuffTrailMode);
+		if (len1 != len2 || memcmp(scratch1, scratch2, len1)) {
+			setcol_error;
+			do_output("Encoder mismatch in %sGRAPH chunk %d!\n", EpisodeInfo.GraphicsFormat, i);
+			setcol_normal;
+			mismatches++;
+		}
+	}
+
+	start = clock();
+	for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+		for (i = 0; i < EpisodeInfo.NumChunks; i++)
+			if (EgaGraph[i].data && EgaGraph[i].len)
+				huff_ctx_compress_bitwise(HuffDict, EgaGraph[i].data, scratch1, EgaGraph[i].len, EgaGraph[i].len * 2, Switches->IgrabHuffTrailMode);
+	bitwisetime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+		for (i = 0; i < EpisodeInfo.NumChunks; i++)
+			if (EgaGraph[i].data && EgaGraph[i].len)
+				huff_ctx_compress(HuffDict, EgaGraph[i].data, scratch1, EgaGraph[i].len, EgaGraph[i].len * 2, Switches->IgrabHuffTrailMode);
+	wordtime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	free(scratch1);
+	free(scratch2);
+
+	do_output("Huffman encode benchmark (%lu bytes x %d passes):\n", total, BENCHMARK_PASSES);
+	benchmark_line("Bitwise:", bitwisetime, total, 0);
+	benchmark_line("Word-at-once:", wordtime, total, bitwisetime);
+	if (mismatches)
+		quit("Word-at-a-time encoder disagreed with the reference on %d chunks!", mismatches);
+
+	/* Byte counting: one counter table against the interleaved kernel */
+	for (j = 0; j < 256; j++)
+		counts1[j] = counts2[j] = 0;
+	start = clock();
+	for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+		for (i = 0; i < EpisodeInfo.NumChunks; i++)
+			if (EgaGraph[i].data)
+				for (k = 0; k < EgaGraph[i].len; k++)
+					counts1[EgaGraph[i].data[k]]++;
+	simpletime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+		for (i = 0; i < EpisodeInfo.NumChunks; i++)
+			if (EgaGraph[i].data)
+				huff_histogram(EgaGraph[i].data, EgaGraph[i].len, counts2);
+	histtime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	do_output("Byte histogram benchmark (%lu bytes x %d passes):\n", total, BENCHMARK_PASSES);
+	benchmark_line("Single table:", simpletime, total, 0);
+	benchmark_line("Interleaved:", histtime, total, simpletime);
+	if (memcmp(counts1, counts2, sizeof (counts1)))
+		quit("Histogram kernel disagreed with the simple byte count!");
+}
+
 void k456_import_end() {
 	char filename[PATH_MAX];
 	int i, j;
-	uint8_t *compdata;
+	uint8_t *graphdata, *headdata;
 	FILE *dictfile, *headfile, *graphfile, *patchfile;
 	uint32_t offset, len, grstart_mask, ptr;
 	int byteCounts[256];
+	int (*chunkCounts)[256];
+	uint32_t *compLens;
+	unsigned long graphlen, headlen;
+	int newdict;
 	char graphicsformat[4];
 
 	if (!ImportInitialised)
@@ -1956,6 +2300,68 @@ void k456_import_end() {
 
 	grstart_mask = 0xFFFFFFFF >> (8 * (4 - EpisodeInfo.GrStarts));
 
+
+	/* Count the bytes in each chunk once; the counts are reused for everything that follows */
+	chunkCounts = (int (*)[256]) calloc(EpisodeInfo.NumChunks, sizeof (*chunkCounts));
+	if (!chunkCounts)
+		quit("Not enough memory to count %sGRAPH bytes!", EpisodeInfo.GraphicsFormat);
+	for (i = 0; i < 256; ++i) {
+		byteCounts[i] = 0;
+	}
+	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
+		if (EgaGraph[i].data && EgaGraph[i].len > 0) {
+			huff_histogram(EgaGraph[i].data, EgaGraph[i].len, chunkCounts[i]);
+			for (j = 0; j < 256; ++j) {
+				byteCounts[j] += chunkCounts[i][j];
+			}
+		}
+	}
+
+	newdict = Switches->OptimizedComp;
+	if (Switches->BestDict)
+		newdict = k456_choose_dictionary(byteCounts, chunkCounts);
+	else if (Switches->OptimizedComp)
+		k456_optimize_dictionary(HuffDict, byteCounts, 1);
+
+	if (newdict) {
+		/* Open the EGADICT file for writing */
+		sprintf(filename, "%s/%sdict.%s", Switches->InputPath, graphicsformat, 
+				EpisodeInfo.GameExt);
+		dictfile = openfile(filename, "wb", Switches->Backup);
+		if (!dictfile)
+			quit("Unable to open %s for writing!", filename);
+
+		huff_ctx_write_dictionary(HuffDict, dictfile);
+		fclose(dictfile);
+	}
+	if (!huff_ctx_setup_compression(HuffDict))
+		quit("%sDICT is missing codes for some bytes!", EpisodeInfo.GraphicsFormat);
+
+	/* Unused bytes may have very long codes, but the ones we output can't */
+	for (i = 0; i < 256; ++i) {
+		if (byteCounts[i] && huff_ctx_code_length(HuffDict, i) > HUFF_MAX_CODE_BITS)
+			quit("%sDICT code for byte 0x%02X is longer than %d bits! Try -optimizedcomp.",
+					EpisodeInfo.GraphicsFormat, i, HUFF_MAX_CODE_BITS);
+	}
+
+	/* Work out exactly how big each compressed chunk, and so the whole ?GAGRAPH, will be */
+	compLens = (uint32_t *) malloc(EpisodeInfo.NumChunks * sizeof (uint32_t));
+	if (!compLens)
+		quit("Not enough memory to size %sGRAPH!", EpisodeInfo.GraphicsFormat);
+	graphlen = k456_graph_size(HuffDict, chunkCounts, compLens);
+	if (graphlen >= grstart_mask)
+		quit("%sGRAPH would be %lu bytes, too large for %d-byte GRSTARTS!", EpisodeInfo.GraphicsFormat,
+				graphlen, EpisodeInfo.GrStarts);
+	do_output("%sGRAPH will be %lu bytes.\n", EpisodeInfo.GraphicsFormat, graphlen);
+
+	/* Lay out the whole ?GAGRAPH (plus a byte, so an undersized estimate shows
+	 * up) and ?GAHEAD in memory, so each can be written in one go */
+	headlen = (EpisodeInfo.NumChunks + 1) * EpisodeInfo.GrStarts;
+	graphdata = (uint8_t *) malloc(graphlen + 1);
+	headdata = (uint8_t *) malloc(headlen);
+	if (!graphdata || !headdata)
+		quit("Not enough memory for compression buffer!");
+
 	/* Open the EGAHEAD and EGAGRAPH files for writing */
 	sprintf(filename, "%s/%shead.%s", Switches->InputPath, graphicsformat, 
 			EpisodeInfo.GameExt);
@@ -1971,96 +2377,65 @@ void k456_import_end() {
 	if (!graphfile)
 		quit("Unable to open %s for writing!", filename);
 
-
-	if (Switches->OptimizedComp) {
-		for (i = 0; i < 256; ++i) {
-			byteCounts[i] = 0;
-		}
-		for (i = 0; i < EpisodeInfo.NumChunks; i++) {
-			if (EgaGraph[i].data && EgaGraph[i].len > 0) {
-				for (j = 0; j < EgaGraph[i].len; ++j) {
-					++byteCounts[EgaGraph[i].data[j]];
-				}
-			}
-		}
-		huffmanize(byteCounts);
-		/* Open the EGADICT file for writing */
-		sprintf(filename, "%s/%sdict.%s", Switches->InputPath, graphicsformat, 
-				EpisodeInfo.GameExt);
-		dictfile = openfile(filename, "wb", Switches->Backup);
-		if (!dictfile)
-			quit("Unable to open %s for writing!", filename);
-
-		huff_write_dictionary(dictfile);
-		fclose(dictfile);
-	}
-	huff_setup_compression();
-
-	/* Compress data and output the EGAHEAD and EGAGRAPH */
+	/* Compress data into the EGAHEAD and EGAGRAPH buffers */
 	do_output("Compressing: ");
 	offset = 0;
 	for (i = 0; i < EpisodeInfo.NumChunks; i++) {
 		/* Show that something is happening */
 		showprogress((int) ((i * 100) / EpisodeInfo.NumChunks));
 
-		if (Switches->IgrabSig) {
-			if (((i == EpisodeInfo.IndexFonts) && EpisodeInfo.NumFonts) ||
-			    ((i == EpisodeInfo.IndexMaskedFonts) && EpisodeInfo.NumMaskedFonts) ||
-			    ((i == EpisodeInfo.IndexBitmaps) && EpisodeInfo.NumBitmaps) ||
-			    ((i == EpisodeInfo.IndexMaskedBitmaps) && EpisodeInfo.NumMaskedBitmaps) || 
-			    ((i == EpisodeInfo.IndexSprites) && EpisodeInfo.NumSprites) || 
-			    ((i == EpisodeInfo.Index8Tiles) && EpisodeInfo.Num8Tiles) || 
-			    ((i == EpisodeInfo.Index8MaskedTiles) && EpisodeInfo.Num8MaskedTiles) || 
-			    ((i == EpisodeInfo.Index16Tiles) && EpisodeInfo.Num16Tiles) || 
-			    ((i == EpisodeInfo.Index16MaskedTiles) && EpisodeInfo.Num16MaskedTiles)
-			) {
-				fwrite("!ID!", 4, 1, graphfile);
-				offset += 4;
-			}
+		if (k456_chunk_has_sig(i)) {
+			memcpy(graphdata + offset, "!ID!", 4);
+			offset += 4;
 		}
 
 		if (EgaGraph[i].data && EgaGraph[i].len > 0) {
 			/* Save the current offset */
 			ptr = offset;
 
-			/* Give some extra room for compressed data (as it's occasionally larger) */
-			compdata = malloc(EgaGraph[i].len * 2);
-			if (!compdata)
-				quit("Not enough memory for compression buffer!");
-
-			len = huff_compress(EgaGraph[i].data, compdata, EgaGraph[i].len, EgaGraph[i].len * 2, Switches->IgrabHuffTrailMode);
-
 			/* If the chunk is not a tile chunk then we need to output the length first */
-			if (i < EpisodeInfo.Index8Tiles || i >= EpisodeInfo.Index32MaskedTiles +
-					EpisodeInfo.Num32MaskedTiles) {
-				fwrite(&EgaGraph[i].len, sizeof (uint32_t), 1, graphfile);
+			if (k456_chunk_has_length(i)) {
+				memcpy(graphdata + offset, &EgaGraph[i].len, sizeof (uint32_t));
 				offset += sizeof (uint32_t);
 			}
-			fwrite(compdata, len, 1, graphfile);
-			free(compdata);
 
-			/* Calculate the next offset (taking t*/
+			len = huff_ctx_compress(HuffDict, EgaGraph[i].data, graphdata + offset, EgaGraph[i].len,
+					graphlen + 1 - offset, Switches->IgrabHuffTrailMode);
+			if (len != compLens[i])
+				quit("%sGRAPH chunk %d compressed to %lu bytes instead of %lu!", EpisodeInfo.GraphicsFormat, i,
+						(unsigned long)len, (unsigned long)compLens[i]);
+
+			/* Calculate the next offset */
 			offset += len;
 		} else {
 			// The same for all Keens according to KDR edition source
 			// Uncanny, isn't it?
 			ptr = grstart_mask;
 		}
-		fwrite(&ptr, EpisodeInfo.GrStarts, 1, headfile);
-
+		memcpy(headdata + i * EpisodeInfo.GrStarts, &ptr, EpisodeInfo.GrStarts);
 	}
 
-	/* Write the final header entry, which is where the n+1'th chunk would start */
+	/* The final header entry, which is where the n+1'th chunk would start */
 	ptr = offset;
-	fwrite(&ptr, EpisodeInfo.GrStarts, 1, headfile);
+	memcpy(headdata + EpisodeInfo.NumChunks * EpisodeInfo.GrStarts, &ptr, EpisodeInfo.GrStarts);
 
-	/*
-		 if (ptr != ftell(graphfile) - 1)
-		 quit("EGAGRAPH improperly sized!");
-		 */
+	if (offset != graphlen)
+		quit("%sGRAPH improperly sized!", EpisodeInfo.GraphicsFormat);
+
+	if (fwrite(graphdata, 1, graphlen, graphfile) != graphlen ||
+			fwrite(headdata, 1, headlen, headfile) != headlen)
+		quit("Unable to write %sGRAPH and %sHEAD!", EpisodeInfo.GraphicsFormat, EpisodeInfo.GraphicsFormat);
 
 	completemsg();
 
+	free(graphdata);
+	free(headdata);
+	free(compLens);
+
+	if (Switches->Benchmark)
+		k456_benchmark_compress();
+	free(chunkCounts);
+
 	/* Close files */
 	fclose(headfile);
 	fclose(graphfile);
@@ -2068,8 +2443,11 @@ void k456_import_end() {
 	/* Free the memory used */
 	free(EgaGraph);
 	free(BmpHead);
+	huff_ctx_free(HuffDict);
+	HuffDict = NULL;
 	free(BmpMaskedHead);
 	free(SprHead);
+	bmp256_pool_flush();
 
 	/* Create the Patch File */
 	if (Switches->Patch) {
@@ -2081,7 +2459,7 @@ void k456_import_end() {
 				"# Load the modified graphics\n"
 				"%%egahead egahead.%s\n",
 				EpisodeInfo.GameExt, EpisodeInfo.CKPatchVer, EpisodeInfo.GameExt);
-		if (Switches->OptimizedComp) {
+		if (newdict) {
 			fprintf(patchfile, "%%egadict egadict.%s\n", EpisodeInfo.GameExt);
 		}
 		fprintf(patchfile, "%%end\n");
@@ -2089,6 +2467,18 @@ void k456_import_end() {
 	}
 }
 
+/* Load a bitmap to import. Truecolor files are mapped to the colours the
+ * graphics were exported with: all 256 for VGA, the 16 colours and their
+ * masked versions for EGA graphics with the mask in the colour data, and
+ * the 16 colours otherwise. */
+static BITMAP256 *k456_load_bitmap(char *filename, bool masked) {
+	if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA"))
+		return bmp256_load_ex(filename, 8, 256);
+	if (masked && !strcmp(EpisodeInfo.GraphicsFormat, "EGA") && !Switches->SeparateMask)
+		return bmp256_load_ex(filename, 8, 32);
+	return bmp256_load_ex(filename, 4, 16);
+}
+
 void k456_import_bitmaps() {
 	BITMAP256 *bmp, *planes[4];
 	char filename[PATH_MAX];
@@ -2110,8 +2500,8 @@ void k456_import_bitmaps() {
 		showprogress((i * 100) / EpisodeInfo.NumBitmaps);
 
 		/* Open the bitmap file */
-		sprintf(filename, "%s/%s_pic_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-		bmp = bmp256_load(filename);
+		sprintf(filename, "%s/%s_pic_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+		bmp = k456_load_bitmap(filename, false);
 		if (!bmp)
 			quit("Can't open bitmap file %s!", filename);
 		if (bmp->width % 8 != 0)
@@ -2132,10 +2522,6 @@ void k456_import_bitmaps() {
 			linewidth = bmp->width/4;
 			numofplanes = 4;
 
-			/* Decode the bmp file */
-			if (!bmp256_munge(bmp,planes,4))
-				quit ("Not enough memory to import bitmap %s!", filename);
-
 		} else if (!strcmp(EpisodeInfo.GraphicsFormat, "EGA")) {
 			BmpHead[i].Width = bmp->width / 8;
 			BmpHead[i].Height = bmp->height;
@@ -2166,17 +2552,22 @@ void k456_import_bitmaps() {
 			quit("Not enough memory for bitmap %d!", i);
 		EgaGraph[EpisodeInfo.IndexBitmaps + i].data = pointer;
 
-		/* Decode the bitmap data */
-		for (p = 0; p < numofplanes; p++) {
-			/* Decode the lines of the bitmap data */
-			pointer = EgaGraph[EpisodeInfo.IndexBitmaps + i].data + p * linewidth * BmpHead[i].Height;
-			for (y = 0; y < BmpHead[i].Height; y++)
-				memcpy(pointer + y * linewidth, planes[p]->lines[y], linewidth);
-		}
+		if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
+			/* Deinterleave the bmp file straight into the planes */
+			bmp256_munge_planar(bmp, pointer, 4);
+		} else {
+			/* Decode the bitmap data */
+			for (p = 0; p < numofplanes; p++) {
+				/* Decode the lines of the bitmap data */
+				pointer = EgaGraph[EpisodeInfo.IndexBitmaps + i].data + p * linewidth * BmpHead[i].Height;
+				for (y = 0; y < BmpHead[i].Height; y++)
+					memcpy(pointer + y * linewidth, planes[p]->lines[y], linewidth);
+			}
 
-		/* Free the memory used */
-		for (p = 0; p < numofplanes; p++) {
-			bmp256_free(planes[p]);
+			/* Free the memory used */
+			for (p = 0; p < numofplanes; p++) {
+				bmp256_free(planes[p]);
+			}
 		}
 		bmp256_free(bmp);
 
@@ -2209,8 +2600,8 @@ void k456_import_masked_bitmaps() {
 			showprogress((i * 100) / EpisodeInfo.NumMaskedBitmaps);
 
 			/* Open the bitmap file */
-			sprintf(filename, "%s/%s_picm_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-			bmp = bmp256_load(filename);
+			sprintf(filename, "%s/%s_picm_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+			bmp = k456_load_bitmap(filename, true);
 			if (!bmp)
 				quit("Can't open bitmap file %s!", filename);
 			if (bmp->width % 8 != 0)
@@ -2221,10 +2612,6 @@ void k456_import_masked_bitmaps() {
 				quit("Bitmap %s doesn't have proper color count!", filename);
 			}
 
-			/* Decode the bmp file */
-			if (!bmp256_munge(bmp,planes,4))
-				quit ("Not enough memory to import bitmap %s!", filename);
-
 			/* Set up the BmpMaskedHead structures */
 			BmpMaskedHead[i].Width = bmp->width;
 			BmpMaskedHead[i].Height = bmp->height;
@@ -2236,18 +2623,10 @@ void k456_import_masked_bitmaps() {
 				quit("Not enough memory for bitmap %d!", i);
 			EgaGraph[EpisodeInfo.IndexMaskedBitmaps + i].data = pointer;
 
-			/* Decode the bitmap data */
-			for (p = 0; p < 4; p++) {
-				/* Decode the lines of the bitmap data */
-				pointer = EgaGraph[EpisodeInfo.IndexMaskedBitmaps + i].data + p * BmpMaskedHead[i].Width / 4 * BmpMaskedHead[i].Height;
-				for (y = 0; y < BmpMaskedHead[i].Height; y++)
-					memcpy(pointer + y * BmpMaskedHead[i].Width / 4, planes[p]->lines[y], BmpMaskedHead[i].Width / 4);
-			}
+			/* Deinterleave the bmp file straight into the planes */
+			bmp256_munge_planar(bmp, pointer, 4);
 
 			/* Free the memory used */
-			for (p = 0; p < 4; p++) {
-				bmp256_free(planes[p]);
-			}
 			bmp256_free(bmp);
 
 		}
@@ -2265,8 +2644,8 @@ void k456_import_masked_bitmaps() {
 			showprogress((i * 100) / EpisodeInfo.NumMaskedBitmaps);
 
 			/* Open the bitmap file and validate it */
-			sprintf(filename, "%s/%s_picm_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-			mbmp = bmp256_load(filename);
+			sprintf(filename, "%s/%s_picm_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+			mbmp = k456_load_bitmap(filename, true);
 			if (!mbmp)
 				quit("Can't open bitmap file %s!", filename);
 			if (mbmp->width % (8 * granularity) != 0)
@@ -2346,8 +2725,24 @@ void k456_import_masked_bitmaps() {
 	}
 }
 
+/* Get the tile at x, y of a tile sheet without allocating anything. When
+ * the sheet has the tile's bpp this is a view into it; otherwise the tile is
+ * converted into buf, which has the size and bpp of the tile. */
+static BITMAP256 *k456_get_tile(BITMAP256 *sheet, unsigned x, unsigned y,
+		BITMAP256 *view, uint8_t **viewlines, BITMAP256 *buf) {
+	if (sheet->bpp == buf->bpp &&
+			bmp256_view(view, viewlines, sheet, x, y, buf->width, buf->height))
+		return view;
+
+	/* Clear it first, as the sheet may not cover all of it */
+	memset(buf->bits, 0, buf->linewidth * buf->height);
+	bmp256_blit(sheet, x, y, buf, 0, 0, buf->width, buf->height);
+	return buf;
+}
+
 void k456_import_tiles() {
-	BITMAP256 *bmp, *tile, *planes[4];
+	BITMAP256 *bmp, *tile, *tilebuf, view, *planes[4];
+	uint8_t *viewlines[16];
 	char filename[PATH_MAX];
 	int i, p, y;
 	uint8_t *pointer;
@@ -2384,8 +2779,8 @@ void k456_import_tiles() {
 	do_output("Importing tiles: ");
 
 	/* Open the bitmap file */
-	sprintf(filename, "%s/%s_tile16.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-	bmp = bmp256_load(filename);
+	sprintf(filename, "%s/%s_tile16.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+	bmp = k456_load_bitmap(filename, false);
 	if (!bmp)
 		quit("Can't open bitmap file %s!", filename);
 	if (bmp->width != 18 * 16)
@@ -2398,21 +2793,31 @@ void k456_import_tiles() {
 		quit("Tile bitmap %s doesn't have proper color count!", filename);
 	}
 
+	/* The tile and its planes are reused for every tile */
+	tilebuf = bmp256_create(16, 16, tilebpp);
+	if (!tilebuf)
+		quit("Not enough memory to create bitmap!");
+	for (p = 0; p < numofplanes; p++) {
+		if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA"))
+			planes[p] = bmp256_create(16 / 4, 16, planebpp);
+		else
+			planes[p] = bmp256_create(16, 16, planebpp);
+		if (!planes[p])
+			quit("Not enough memory to create bitmap!");
+	}
+
 	for (i = 0; i < EpisodeInfo.Num16Tiles; i++) {
 		/* Show that something is happening */
 		showprogress((i * 100) / EpisodeInfo.Num16Tiles);
 
 		/* Extract the tile we want */
-		tile = bmp256_create(16, 16, tilebpp);
-		if (!tile)
-			quit("Not enough memory to create bitmap!");
-		bmp256_blit(bmp, (i % 18) * 16, (i / 18) * 16, tile, 0, 0, 16, 16);
+		tile = k456_get_tile(bmp, (i % 18) * 16, (i / 18) * 16, &view, viewlines, tilebuf);
 
 		/* Decode the tile */
 		if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
-			bmp256_munge(tile, planes, 4);
+			bmp256_munge_into(tile, planes, 4);
 		} else {
-			bmp256_split_ex2(tile, planes, 0, numofplanes, planebpp);
+			bmp256_split_into(tile, planes, 0, numofplanes, planebpp);
 		}
 
 		/* Allocate memory for the data */
@@ -2433,12 +2838,6 @@ void k456_import_tiles() {
 				memcpy(pointer + linewidth * y, planes[p]->lines[y], linewidth);
 		}
 
-		/* Free the memory used */
-		for (p = 0; p < numofplanes; p++) {
-			bmp256_free(planes[p]);
-		}
-		bmp256_free(tile);
-
 		/* Check for sparse tile */
 		if (Switches->SparseTiles && !memcmp(EgaGraph[EpisodeInfo.Index16Tiles + i].data, Sparse16TilePtr, EgaGraph[EpisodeInfo.Index16Tiles + i].len)) {
 			free(EgaGraph[EpisodeInfo.Index16Tiles + i].data);
@@ -2448,12 +2847,18 @@ void k456_import_tiles() {
 	}
 	completemsg();
 
+	/* Free the memory used */
+	for (p = 0; p < numofplanes; p++) {
+		bmp256_free(planes[p]);
+	}
+	bmp256_free(tilebuf);
 	bmp256_free(bmp);
 
 }
 
 void k456_import_masked_tiles() {
-	BITMAP256 *bmp, *tile, *planes[6];
+	BITMAP256 *bmp, *tile, *tilebuf, *maskbuf, view, maskview, *planes[6], *split[6];
+	uint8_t *viewlines[16], *masklines[16];
 	char filename[PATH_MAX];
 	int i, p, y;
 	unsigned granularity;
@@ -2473,8 +2878,8 @@ void k456_import_masked_tiles() {
 	granularity = doSeparateMask ? 2 : 1;
 
 	/* Open the bitmap file */
-	sprintf(filename, "%s/%s_tile16m.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-	bmp = bmp256_load(filename);
+	sprintf(filename, "%s/%s_tile16m.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+	bmp = k456_load_bitmap(filename, true);
 	if (!bmp)
 		quit("Can't open bitmap file %s!", filename);
 	if (bmp->width != 18 * 16 * granularity)
@@ -2515,34 +2920,40 @@ void k456_import_masked_tiles() {
 	// reason. So we support importing such tiles back, just for
 	// the possibility of faithfully recreating original
 	// xGAGRAPH files.
+	/* The tile, its mask and its planes are reused for every tile */
+	tilebuf = bmp256_create(16, 16, tilebpp);
+	maskbuf = bmp256_create(16, 16, planebpp);
+	if (!tilebuf || !maskbuf)
+		quit("Not enough memory to create bitmap!");
+	for (p = 0; p < totalnumofplanes; p++) {
+		split[p] = bmp256_create(16, 16, planebpp);
+		if (!split[p])
+			quit("Not enough memory to create bitmap!");
+	}
+
 	for (i = 0; i < EpisodeInfo.Num16MaskedTiles; i++) {
 		/* Show that something is happening */
 		showprogress((i * 100) / EpisodeInfo.Num16MaskedTiles);
 
 		/* Extract the color data of the tile we want */
-		tile = bmp256_create(16, 16, tilebpp);
-		if (!tile)
-			quit("Not enough memory to create bitmap!");
-		bmp256_blit(bmp, (i % 18) * 16, (i / 18) * 16, tile, 0, 0, 16, 16);
+		tile = k456_get_tile(bmp, (i % 18) * 16, (i / 18) * 16, &view, viewlines, tilebuf);
 
 
 		/* Extract the tile mask */
 		if (doSeparateMask) {
 			/* Get the color planes */
-			if (!bmp256_split_ex2(tile, &planes[1], 0, totalnumofplanes-1, planebpp))
-				quit("Not enough memory to create bitmap!");
+			bmp256_split_into(tile, split, 0, totalnumofplanes-1, planebpp);
+			for (p = 1; p < totalnumofplanes; p++)
+				planes[p] = split[p - 1];
 
 			/* Get the mask */
-			planes[0] = bmp256_create(16, 16, planebpp);
-			if (!planes[0])
-				quit("Not enough memory to create bitmap!");
-			bmp256_blit(bmp, 16 * 18 + (i % 18) * 16, (i / 18) * 16, planes[0], 0, 0, 16, 16);
+			planes[0] = k456_get_tile(bmp, 16 * 18 + (i % 18) * 16, (i / 18) * 16, &maskview, masklines, maskbuf);
 		} else {
 			/* Get mask and color plane, and shuffle planes into order */
-			if (!bmp256_split_ex2(tile, &planes[1], 0, totalnumofplanes, planebpp))
-				quit("Not enough memory to create bitmap!");
-			planes[0] = planes[totalnumofplanes];
-			planes[totalnumofplanes] = NULL;
+			bmp256_split_into(tile, split, 0, totalnumofplanes, planebpp);
+			for (p = 1; p < totalnumofplanes; p++)
+				planes[p] = split[p - 1];
+			planes[0] = split[totalnumofplanes - 1];
 		}
 
 		/* Allocate memory for the data */
@@ -2563,12 +2974,6 @@ void k456_import_masked_tiles() {
 				memcpy(pointer + y * linewidth, planes[p]->lines[y], linewidth);
 		}
 
-		/* Free the memory used */
-		for (p = 0; p < totalnumofplanes; p++) {
-			bmp256_free(planes[p]);
-		}
-		bmp256_free(tile);
-
 		/* Check for sparse tile */
 		if (Switches->SparseTiles && !memcmp(EgaGraph[EpisodeInfo.Index16MaskedTiles + i].data, SparseMasked16TilePtr, EgaGraph[EpisodeInfo.Index16MaskedTiles + i].len)) {
 			free(EgaGraph[EpisodeInfo.Index16MaskedTiles + i].data);
@@ -2578,11 +2983,18 @@ void k456_import_masked_tiles() {
 	}
 	completemsg();
 
+	/* Free the memory used */
+	for (p = 0; p < totalnumofplanes; p++) {
+		bmp256_free(split[p]);
+	}
+	bmp256_free(tilebuf);
+	bmp256_free(maskbuf);
 	bmp256_free(bmp);
 }
 
 void k456_import_8_tiles() {
-	BITMAP256 *bmp, *tile, *planes[4];
+	BITMAP256 *bmp, *tile, *tilebuf, view, *planes[4];
+	uint8_t *viewlines[8];
 	char filename[PATH_MAX];
 	int i, p, y;
 	uint32_t blocksize, tilebpp, linewidth, planebpp, numofplanes;
@@ -2598,8 +3010,8 @@ void k456_import_8_tiles() {
 	do_output("Importing 8x8 tiles: ");
 
 	/* Open the bitmap file */
-	sprintf(filename, "%s/%s_tile8.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-	bmp = bmp256_load(filename);
+	sprintf(filename, "%s/%s_tile8.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+	bmp = k456_load_bitmap(filename, false);
 	if (!bmp)
 		quit("Can't open bitmap file %s!", filename);
 	if (bmp->width != 8)
@@ -2637,21 +3049,31 @@ void k456_import_8_tiles() {
 		quit("Not enough memory for 8x8 tiles!");
 	EgaGraph[EpisodeInfo.Index8Tiles].data = pointer;
 
+	/* The tile and its planes are reused for every tile */
+	tilebuf = bmp256_create(8, 8, tilebpp);
+	if (!tilebuf)
+		quit("Not enough memory to create bitmap!");
+	for (p = 0; p < numofplanes; p++) {
+		if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA"))
+			planes[p] = bmp256_create(8 / 4, 8, planebpp);
+		else
+			planes[p] = bmp256_create(8, 8, planebpp);
+		if (!planes[p])
+			quit("Not enough memory to create bitmap!");
+	}
+
 	for (i = 0; i < EpisodeInfo.Num8Tiles; i++) {
 		/* Show that something is happening */
 		showprogress((i * 100) / EpisodeInfo.Num8Tiles);
 
 		/* Extract the tile we want */
-		tile = bmp256_create(8, 8, tilebpp);
-		if (!tile)
-			quit("Not enough memory to create bitmap!");
-		bmp256_blit(bmp, 0, i * 8, tile, 0, 0, 8, 8);
+		tile = k456_get_tile(bmp, 0, i * 8, &view, viewlines, tilebuf);
 
 		/* Decode the tile */
 		if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
-			bmp256_munge(tile, planes, 4);
+			bmp256_munge_into(tile, planes, 4);
 		} else {
-			bmp256_split_ex2(tile, planes, 0, numofplanes, planebpp);
+			bmp256_split_into(tile, planes, 0, numofplanes, planebpp);
 		}
 
 		/* Decode the bitmap data */
@@ -2665,20 +3087,20 @@ void k456_import_8_tiles() {
 				memcpy(pointer + y * linewidth, planes[p]->lines[y], linewidth);
 		}
 
-		/* Free the memory used */
-		for (p = 0; p < numofplanes; p++) {
-			bmp256_free(planes[p]);
-		}
-		bmp256_free(tile);
-
 	}
 	completemsg();
 
+	/* Free the memory used */
+	for (p = 0; p < numofplanes; p++) {
+		bmp256_free(planes[p]);
+	}
+	bmp256_free(tilebuf);
 	bmp256_free(bmp);
 }
 
 void k456_import_8_masked_tiles() {
-	BITMAP256 *bmp, *tile, *planes[6];
+	BITMAP256 *bmp, *tile, *tilebuf, *maskbuf, view, maskview, *planes[6], *split[6];
+	uint8_t *viewlines[8], *masklines[8];
 	char filename[PATH_MAX];
 	int i, p, y;
 	uint32_t blocksize, tilebpp, linewidth, planebpp, totalnumofplanes;
@@ -2697,8 +3119,8 @@ void k456_import_8_masked_tiles() {
 	if (!strcmp(EpisodeInfo.GraphicsFormat, "VGA")) {
 
 		/* Open the bitmap file */
-		sprintf(filename, "%s/%s_tile8m.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-		bmp = bmp256_load(filename);
+		sprintf(filename, "%s/%s_tile8m.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+		bmp = k456_load_bitmap(filename, true);
 		if (!bmp)
 			quit("Can't open bitmap file %s!", filename);
 		if (bmp->width != 8)
@@ -2717,18 +3139,25 @@ void k456_import_8_masked_tiles() {
 			quit("Not enough memory for 8x8 tiles!");
 		EgaGraph[EpisodeInfo.Index8MaskedTiles].data = pointer;
 
+		/* The tile and its planes are reused for every tile */
+		tilebuf = bmp256_create(8, 8, tilebpp);
+		if (!tilebuf)
+			quit("Not enough memory to create bitmap!");
+		for (p = 0; p < 4; p++) {
+			planes[p] = bmp256_create(8 / 4, 8, tilebpp);
+			if (!planes[p])
+				quit("Not enough memory to create bitmap!");
+		}
+
 		for (i = 0; i < EpisodeInfo.Num8MaskedTiles; i++) {
 			/* Show that something is happening */
 			showprogress((i * 100) / EpisodeInfo.Num8MaskedTiles);
 
 			/* Extract the tile we want */
-			tile = bmp256_create(8, 8, tilebpp);
-			if (!tile)
-				quit("Not enough memory to create bitmap!");
-			bmp256_blit(bmp, 0, i * 8, tile, 0, 0, 8, 8);
+			tile = k456_get_tile(bmp, 0, i * 8, &view, viewlines, tilebuf);
 
 			/* Decode the tile */
-			bmp256_munge(tile, planes, 4);
+			bmp256_munge_into(tile, planes, 4);
 
 			/* Decode the bitmap data */
 			for (p = 0; p < 4; p++) {
@@ -2740,15 +3169,14 @@ void k456_import_8_masked_tiles() {
 				for (y = 0; y < 8; y++)
 					memcpy(pointer + y * linewidth, planes[p]->lines[y], linewidth);
 			}
-
-			/* Free the memory used */
-			for (p = 0; p < 4; p++) {
-				bmp256_free(planes[p]);
-			}
-			bmp256_free(tile);
 		}
 		completemsg();
 
+		/* Free the memory used */
+		for (p = 0; p < 4; p++) {
+			bmp256_free(planes[p]);
+		}
+		bmp256_free(tilebuf);
 		bmp256_free(bmp);
 
 	} else {
@@ -2756,8 +3184,8 @@ void k456_import_8_masked_tiles() {
 		granularity = Switches->SeparateMask ? 2 : 1;
 
 		/* Open the bitmap file */
-		sprintf(filename, "%s/%s_tile8m.bmp", Switches->OutputPath, EpisodeInfo.GameExt);
-		bmp = bmp256_load(filename);
+		sprintf(filename, "%s/%s_tile8m.%s", Switches->OutputPath, EpisodeInfo.GameExt, Switches->ImageExt);
+		bmp = k456_load_bitmap(filename, true);
 		if (!bmp)
 			quit("Can't open bitmap file %s!", filename);
 		if (bmp->width != 8 * granularity)
@@ -2792,33 +3220,40 @@ void k456_import_8_masked_tiles() {
 			quit("Not enough memory for 8x8 masked tiles!");
 		EgaGraph[EpisodeInfo.Index8MaskedTiles].data = pointer;
 
+		/* The tile, its mask and its planes are reused for every tile */
+		tilebuf = bmp256_create(8, 8, tilebpp);
+		maskbuf = bmp256_create(8, 8, planebpp);
+		if (!tilebuf || !maskbuf)
+			quit("Not enough memory to create bitmap!");
+		for (p = 0; p < totalnumofplanes; p++) {
+			split[p] = bmp256_create(8, 8, planebpp);
+			if (!split[p])
+				quit("Not enough memory to create bitmap!");
+		}
 
 		for (i = 0; i < EpisodeInfo.Num8MaskedTiles; i++) {
 			/* Show that something is happening */
 			showprogress((i * 100) / EpisodeInfo.Num8MaskedTiles);
 
 			/* Extract the color planes from the tile we want */
-			tile = bmp256_create(8, 8, tilebpp);
-			if (!tile)
-				quit("Not enough memory to create bitmap!");
-			bmp256_blit(bmp, 0, i * 8, tile, 0, 0, 8, 8);
+			tile = k456_get_tile(bmp, 0, i * 8, &view, viewlines, tilebuf);
 
 
 			/* Extract the tile mask*/
 			if (Switches->SeparateMask) {
 				/* Grab the color info */
-				bmp256_split_ex2(tile, &planes[1], 0, totalnumofplanes-1, planebpp);
+				bmp256_split_into(tile, split, 0, totalnumofplanes-1, planebpp);
+				for (p = 1; p < totalnumofplanes; p++)
+					planes[p] = split[p - 1];
 
 				/* Copy the mask from the right half of the bitmap */
-				planes[0] = bmp256_create(8, 8, planebpp);
-				if (!planes[0])
-					quit("Not enough memory to create bitmap!");
-				bmp256_blit(bmp, 8, i * 8, planes[0], 0, 0, 8, 8);
+				planes[0] = k456_get_tile(bmp, 8, i * 8, &maskview, masklines, maskbuf);
 			} else {
 				/* Grab all planes and move them into the correct order */
-				bmp256_split_ex2(tile, &planes[1], 0, totalnumofplanes, planebpp);
-				planes[0] = planes[totalnumofplanes];
-				planes[totalnumofplanes] = NULL;
+				bmp256_split_into(tile, split, 0, totalnumofplanes, planebpp);
+				for (p = 1; p < totalnumofplanes; p++)
+					planes[p] = split[p - 1];
+				planes[0] = split[totalnumofplanes - 1];
 			}
 
 
@@ -2833,15 +3268,15 @@ void k456_import_8_masked_tiles() {
 					memcpy(pointer + y * linewidth, planes[p]->lines[y], linewidth);
 			}
 
-			/* Free the memory used */
-			for (p = 0; p < totalnumofplanes; p++) {
-				bmp256_free(planes[p]);
-			}
-			bmp256_free(tile);
-
 		}
 		completemsg();
 
+		/* Free the memory used */
+		for (p = 0; p < totalnumofplanes; p++) {
+			bmp256_free(split[p]);
+		}
+		bmp256_free(tilebuf);
+		bmp256_free(maskbuf);
 		bmp256_free(bmp);
 	}
 }
@@ -3000,8 +3435,8 @@ void k456_import_fonts() {
 		showprogress((i * 100) / EpisodeInfo.NumFonts);
 
 		/* Open the bitmap */
-		sprintf(filename, "%s/%s_fon_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-		font = bmp256_load(filename);
+		sprintf(filename, "%s/%s_fon_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+		font = k456_load_bitmap(filename, false);
 		if (!font)
 			quit("Can't open bitmap file %s!", filename);
 		if (font->width % 16 != 0)
@@ -3140,8 +3575,8 @@ void k456_import_sprites() {
 			granularity = 2;
 
 			/* Open the bitmap file */
-			sprintf(filename, "%s/%s_sprite_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-			spr = bmp256_load(filename);
+			sprintf(filename, "%s/%s_sprite_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+			spr = k456_load_bitmap(filename, true);
 			if (!spr)
 				quit("Can't open bitmap file %s!", filename);
 			if (spr->width % (granularity * 8) != 0)
@@ -3191,8 +3626,8 @@ void k456_import_sprites() {
 		} else {
 
 			/* Open the bitmap file */
-			sprintf(filename, "%s/%s_sprite_%04d.bmp", Switches->OutputPath, EpisodeInfo.GameExt, i);
-			spr = bmp256_load(filename);
+			sprintf(filename, "%s/%s_sprite_%04d.%s", Switches->OutputPath, EpisodeInfo.GameExt, i, Switches->ImageExt);
+			spr = k456_load_bitmap(filename, true);
 			if (!spr)
 				quit("Can't open bitmap file %s!", filename);
 			if (spr->width % (granularity * 8) != 0)
@@ -3279,6 +3714,7 @@ void k456_import_terminator_text() {
 	MiscInfoList *mp;
 	int y, len;
 	BITMAP256 *bmp;
+	BMP256_GETTER get;
 	char filename[PATH_MAX];
 	char *pointer;
 	uint16_t *rleptr;
@@ -3295,8 +3731,8 @@ void k456_import_terminator_text() {
 			continue;
 
 		/* Open the bitmap */
-		sprintf(filename, "%s/%s_terminator_%s.bmp", Switches->OutputPath, EpisodeInfo.GameExt, mp->File);
-		bmp = bmp256_load(filename);
+		sprintf(filename, "%s/%s_terminator_%s.%s", Switches->OutputPath, EpisodeInfo.GameExt, mp->File, Switches->ImageExt);
+		bmp = bmp256_load_ex(filename, 1, 2);
 		if (!bmp)
 			quit("Can't open bitmap file %s!", filename);
 
@@ -3308,6 +3744,7 @@ void k456_import_terminator_text() {
 		((TerminatorHeadStruct*) pointer)->Height = bmp->height;
 		((TerminatorHeadStruct*) pointer)->Width = bmp->width;
 
+		get = bmp256_getter(bmp->bpp);
 		for (y = 0; y < bmp->height; y++) {
 			int color, x, runlength;
 
@@ -3323,7 +3760,7 @@ void k456_import_terminator_text() {
 			x = 0;
 			runlength = 0;
 			while (x < bmp->width) {
-				if (bmp256_getpixel(bmp, x, y) == color) {
+				if (get(bmp->lines[y], x) == color) {
 					runlength++;
 					x++;
 				} else {
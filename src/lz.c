@@ -20,8 +20,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "pconio.h"
+#include "lz.h"
 
 /* Helper functions for compression and decompression */
 int lzd_first_char( int code );
@@ -164,13 +166,15 @@ int lzd_first_char( int icode ) {
 
 int lzd_write_string( char **pout, int icode, int ichar ) {
     int count = 0, i;
-    static int stack[128];
+    /* Each table entry adds one char to an earlier string, so no string */
+    /* can be longer than the table */
+    static int stack[TABLESIZE];
     int sp = 0;
 
     /* Put the string onto the stack */
     do {
         /* Make sure we're not about to overrun the stack */
-        if( sp >= 128 ) {
+        if( sp >= TABLESIZE ) {
             do_output("LZ: output stack overflow\n");
             exit( 1 );
         }
@@ -264,6 +268,10 @@ long lz_compress( FILE *fin, FILE *fout ) {
     }
     //i.output the code word which denotes P to the codestream;
     OutLen += lze_write_code( fout, CurStr, NumBits, 0 );
+    /* The decoder adds a table entry for that last code too, which may */
+    /* take it up to the next code size, so the marker must follow suit */
+    if( CurEntry + 1 == (1 << NumBits) && NumBits < MAXBITS )
+        NumBits++;
     /* Output the end-of-file marker */
     OutLen += lze_write_code( fout, LZ_EOF, NumBits, 0 );
 
@@ -335,7 +343,7 @@ int lze_add_key( int str, int ch, int code ) {
     hash = HASH( str, ch );
     index = lz_key_table[ hash ];
     while( index != -1 ) {
-        hash++;
+        hash = (hash+1) & (2*TABLESIZE-1);
         index = lz_key_table[ hash ];
     }
     lz_key_table[ hash ] = code;
@@ -344,3 +352,337 @@ int lze_add_key( int str, int ch, int code ) {
 
     return hash;
 }
+
+
+/* The same algorithms working on memory buffers, with the string tables in */
+/* a context rather than static variables */
+
+/* Reads codes most significant bit first from a buffer */
+typedef struct {
+    const unsigned char *p, *end;
+    uint64_t bits;    /* Unread bits, starting from the top */
+    int count;        /* Number of unread bits */
+} lzbitreader;
+
+/* Where a decompression stream is up to */
+enum { LZS_START, LZS_RUNNING, LZS_DONE, LZS_ERROR };
+
+struct LZContext {
+    int key_table[2*TABLESIZE];    /* Used only by lz_ctx_compress */
+    int code_table[TABLESIZE];
+    int char_table[TABLESIZE];
+    int first_table[TABLESIZE];    /* Used only by the decoder */
+    int len_table[TABLESIZE];      /* Used only by the decoder */
+
+    /* Decoder state kept between calls to lz_ctx_stream_read */
+    lzbitreader br;
+    int state;
+    int NumBits, CurEntry, LastCode;
+    unsigned long PendingDone;     /* Bytes of LastCode's string already output */
+};
+
+/* Writes codes most significant bit first into a buffer */
+typedef struct {
+    unsigned char *p, *end;
+    uint32_t bits;    /* Unwritten bits, at the bottom */
+    int count;        /* Number of unwritten bits */
+    int overflow;     /* Set if the buffer filled up */
+} lzbitwriter;
+
+LZContext *lz_ctx_create( void ) {
+    return (LZContext *) malloc( sizeof( LZContext ) );
+}
+
+void lz_ctx_free( LZContext *ctx ) {
+    free( ctx );
+}
+
+static void lzd_ctx_refill( lzbitreader *br ) {
+    uint64_t word;
+
+    if( br->end - br->p >= 8 ) {
+        /* Load eight bytes at once and keep as many whole bytes as fit. */
+        /* The bits of a partly kept byte are loaded again next time */
+        word = ((uint64_t)br->p[0] << 56) | ((uint64_t)br->p[1] << 48) |
+            ((uint64_t)br->p[2] << 40) | ((uint64_t)br->p[3] << 32) |
+            ((uint64_t)br->p[4] << 24) | ((uint64_t)br->p[5] << 16) |
+            ((uint64_t)br->p[6] << 8) | (uint64_t)br->p[7];
+        br->bits |= word >> br->count;
+        br->p += (63 - br->count) >> 3;
+        br->count |= 56;
+    } else {
+        /* Near the end of the input, a byte at a time */
+        while( br->count <= 56 && br->p < br->end ) {
+            br->bits |= (uint64_t)*br->p++ << (56 - br->count);
+            br->count += 8;
+        }
+    }
+}
+
+/* Returns the next code, or -1 if the input has run out */
+static int lzd_ctx_read_code( lzbitreader *br, int NumBits ) {
+    int code;
+
+    if( br->count < NumBits ) {
+        lzd_ctx_refill( br );
+        if( br->count < NumBits )
+            return -1;
+    }
+    code = (int)(br->bits >> (64 - NumBits));
+    br->bits <<= NumBits;
+    br->count -= NumBits;
+    return code;
+}
+
+/* Writes up to space bytes of the string for icode, starting skip bytes */
+/* in. Each entry holds its last char and a link to the rest of the */
+/* string, so the string is written from the end back to the start. */
+/* Returns the number of bytes written. */
+static unsigned long lzd_ctx_write_string( LZContext *ctx, unsigned char *pout,
+    unsigned long space, int icode, unsigned long skip ) {
+    unsigned long len = ctx->len_table[ icode ] - skip;
+    unsigned char *p;
+
+    /* Drop the end of the string if it doesn't all fit */
+    for( ; len > space; len-- )
+        icode = ctx->code_table[ icode ];
+
+    p = pout + len;
+    while( p > pout ) {
+        *--p = ctx->char_table[ icode ];
+        icode = ctx->code_table[ icode ];
+    }
+
+    return len;
+}
+
+/* Start decompressing inlen bytes of LZ data at pin, which must stay */
+/* available until the stream is finished with */
+void lz_ctx_stream_begin( LZContext *ctx, const unsigned char *pin, unsigned long inlen ) {
+    int i;
+
+    ctx->br.p = pin;
+    ctx->br.end = pin + inlen;
+    ctx->br.bits = 0;
+    ctx->br.count = 0;
+
+    /* Initialise the string tables; only the single chars exist so far */
+    for( i = 0; i < 256; i++ ) {
+        ctx->code_table[i] = -1;
+        ctx->char_table[i] = i;
+        ctx->first_table[i] = i;
+        ctx->len_table[i] = 1;
+    }
+
+    /* We start with 9-bit codes, adding entries after ERROR and EOF */
+    ctx->NumBits = 9;
+    ctx->CurEntry = LZ_START;
+    ctx->state = LZS_START;
+}
+
+/* Decompress the next outlen bytes (or fewer, if the data ends first) of */
+/* the stream into pout. A string that doesn't fit is carried over to the */
+/* next call. Returns the number of bytes output, which is 0 once the */
+/* end-of-file code has been reached, or -1 if the data is corrupt or cut */
+/* short. */
+long lz_ctx_stream_read( LZContext *ctx, unsigned char *pout, unsigned long outlen ) {
+    int NewCode, CurChar;
+    int NumBits = ctx->NumBits, CurEntry = ctx->CurEntry;
+    unsigned long OutLen = 0, count;
+
+    if( ctx->state == LZS_ERROR )
+        return -1;
+    if( ctx->state == LZS_DONE || outlen == 0 )
+        return 0;
+
+    if( ctx->state == LZS_START ) {
+        /* The first code is always a single character */
+        NewCode = lzd_ctx_read_code( &ctx->br, NumBits );
+        if( NewCode == LZ_EOF ) {
+            ctx->state = LZS_DONE;
+            return 0;
+        }
+        if( NewCode < 0 || NewCode > 255 ) {
+            ctx->state = LZS_ERROR;
+            return -1;
+        }
+        ctx->LastCode = NewCode;
+        ctx->PendingDone = 0;
+        ctx->state = LZS_RUNNING;
+    }
+
+    /* Finish the string that didn't fit last time */
+    if( ctx->PendingDone < (unsigned long)ctx->len_table[ ctx->LastCode ] ) {
+        count = lzd_ctx_write_string( ctx, pout, outlen, ctx->LastCode, ctx->PendingDone );
+        ctx->PendingDone += count;
+        OutLen += count;
+    }
+
+    while( OutLen < outlen ) {
+        NewCode = lzd_ctx_read_code( &ctx->br, NumBits );
+        if( NewCode == LZ_EOF ) {
+            ctx->state = LZS_DONE;
+            break;
+        }
+        if( NewCode < 0 || (NewCode >= 256 && NewCode < LZ_START) || NewCode > CurEntry ) {
+            ctx->state = LZS_ERROR;
+            return -1;
+        }
+
+        /* The new entry is the last string plus the first char of this one. */
+        /* If this is the entry being defined, that is the last string's */
+        /* first char too. */
+        if( NewCode < CurEntry )
+            CurChar = ctx->first_table[ NewCode ];
+        else
+            CurChar = ctx->first_table[ ctx->LastCode ];
+
+        if( CurEntry < TABLESIZE ) {
+            ctx->code_table[ CurEntry ] = ctx->LastCode;
+            ctx->char_table[ CurEntry ] = CurChar;
+            ctx->first_table[ CurEntry ] = ctx->first_table[ ctx->LastCode ];
+            ctx->len_table[ CurEntry ] = ctx->len_table[ ctx->LastCode ] + 1;
+
+            CurEntry++;
+            /* Increase the bit size as necessary */
+            if( CurEntry == (1 << NumBits) - 1 && NumBits < MAXBITS )
+                NumBits++;
+        }
+
+        ctx->LastCode = NewCode;
+        ctx->PendingDone = lzd_ctx_write_string( ctx, pout + OutLen, outlen - OutLen, NewCode, 0 );
+        OutLen += ctx->PendingDone;
+    }
+
+    ctx->NumBits = NumBits;
+    ctx->CurEntry = CurEntry;
+    return OutLen;
+}
+
+/* Decompress inlen bytes of LZ data at pin into pout. Stops at the */
+/* end-of-file code, or once outlen bytes have been output. Returns the */
+/* number of bytes output, or -1 if the data is corrupt or cut short. */
+long lz_ctx_decompress( LZContext *ctx, const unsigned char *pin, unsigned long inlen,
+    unsigned char *pout, unsigned long outlen ) {
+    lz_ctx_stream_begin( ctx, pin, inlen );
+    return lz_ctx_stream_read( ctx, pout, outlen );
+}
+
+static void lze_ctx_write_code( lzbitwriter *bw, int code, int NumBits ) {
+    /* Once the output is full, nothing more is written or counted */
+    if( bw->overflow )
+        return;
+    bw->bits = (bw->bits << NumBits) | (code & ((1 << NumBits) - 1));
+    bw->count += NumBits;
+    while( bw->count >= 8 ) {
+        bw->count -= 8;
+        if( bw->p == bw->end ) {
+            bw->overflow = 1;
+            return;
+        }
+        *bw->p++ = (unsigned char)(bw->bits >> bw->count);
+    }
+}
+
+/* HASH only ORs the char into the string's bits, so similar strings pile */
+/* up in the same slots. Multiplying by a large odd constant and keeping */
+/* the top bits spreads them over the whole key table. */
+#define LZ_KEY_BITS (MAXBITS + 1)
+#define CTX_HASH(x,y) ((((uint32_t)(x) << 8 | (y)) * 2654435761U) >> (32 - LZ_KEY_BITS))
+
+static int lze_ctx_in_table( LZContext *ctx, int str, int ch ) {
+    int hash, index;
+
+    /* If there's no preceding str, then we have a single char */
+    if( str == -1 )
+        return ch;
+
+    hash = CTX_HASH( str, ch );
+    index = ctx->key_table[ hash ];
+    while( index != -1 && (str != ctx->code_table[index] ||
+            ch != ctx->char_table[index]) ) {
+        hash = (hash+1) & (2*TABLESIZE-1);
+        index = ctx->key_table[ hash ];
+    }
+    return index;
+}
+
+static void lze_ctx_add_key( LZContext *ctx, int str, int ch, int code ) {
+    int hash;
+
+    hash = CTX_HASH( str, ch );
+    while( ctx->key_table[ hash ] != -1 )
+        hash = (hash+1) & (2*TABLESIZE-1);
+    ctx->key_table[ hash ] = code;
+    ctx->code_table[ code ] = str;
+    ctx->char_table[ code ] = ch;
+}
+
+/* Compress inlen bytes at pin into pout, which has room for outlen bytes */
+/* (LZ_COMPRESS_BOUND(inlen) is always enough). The output is the same as */
+/* lz_compress gives. Returns its length, or -1 if it didn't fit. */
+long lz_ctx_compress( LZContext *ctx, const unsigned char *pin, unsigned long inlen,
+    unsigned char *pout, unsigned long outlen ) {
+    lzbitwriter bw;
+    int NumBits, CurEntry, CurStr, CurChar, Key;
+    unsigned long i;
+
+    bw.p = pout;
+    bw.end = pout + outlen;
+    bw.bits = 0;
+    bw.count = 0;
+    bw.overflow = 0;
+
+    /* We start with 9-bit codes */
+    NumBits = 9;
+
+    /* Initialise the string tables */
+    for( i = 0; i < 2*TABLESIZE; i++ )
+        ctx->key_table[i] = -1;
+    for( i = 0; i < 256; i++ ) {
+        ctx->code_table[i] = -1;
+        ctx->char_table[i] = i;
+    }
+    for( i = 256; i < TABLESIZE; i++ ) {
+        ctx->code_table[i] = -1;
+        ctx->char_table[i] = -1;
+    }
+    CurEntry = LZ_START;
+
+    CurStr = -1;
+    for( i = 0; i < inlen; i++ ) {
+        CurChar = pin[i];
+
+        /* Extend the current string if the result is in the dictionary */
+        Key = lze_ctx_in_table( ctx, CurStr, CurChar );
+        if( Key != -1 ) {
+            CurStr = Key;
+            continue;
+        }
+
+        /* Otherwise output it, add it plus this char, and start again */
+        lze_ctx_write_code( &bw, CurStr, NumBits );
+        if( CurEntry < TABLESIZE ) {
+            lze_ctx_add_key( ctx, CurStr, CurChar, CurEntry );
+            CurEntry++;
+            /* Increase the bit size as necessary */
+            if( CurEntry == (1 << NumBits) && NumBits < MAXBITS )
+                NumBits++;
+        }
+        CurStr = CurChar;
+    }
+
+    lze_ctx_write_code( &bw, CurStr, NumBits );
+    /* The decoder adds a table entry for that last code too */
+    if( CurEntry + 1 == (1 << NumBits) && NumBits < MAXBITS )
+        NumBits++;
+    lze_ctx_write_code( &bw, LZ_EOF, NumBits );
+
+    /* Output any remaining bits */
+    if( bw.count > 0 )
+        lze_ctx_write_code( &bw, 0, 8 - bw.count );
+
+    if( bw.overflow )
+        return -1;
+    return bw.p - pout;
+}
@@ -36,6 +36,7 @@
 #include "keen456.h"
 #include "parser.h"
 #include "pconio.h"
+#include "selftest.h"
 #include "switches.h"
 #include "utils.h"
 
@@ -132,7 +133,11 @@ int main(int argc, char *argv[]) {
 	do_output(txt_signature1);
 	do_output(txt_signature2);
 
-	if (switches->Export) {
+	if (switches->SelfTest) {
+		/* Check the codecs against their reference versions */
+		if (!selftest_run(switches))
+			quit("The self test failed!");
+	} else if (switches->Export) {
 		/* Set exporting palette */
 		if (strcmp("", switches->PalettePath)) {
 			if (!bmp256_setpalette(switches->PalettePath))
@@ -140,6 +145,9 @@ int main(int argc, char *argv[]) {
 						switches->PalettePath);
 		}
 
+		/* Compress exported bitmaps */
+		bmp256_setcompression(switches->RleBitmaps);
+
 		/* Export all data */
 		if (switches->EpisodeDefPath) {
 			if (parse_definition_file(switches->EpisodeDefPath,
@@ -170,6 +178,17 @@ int main(int argc, char *argv[]) {
 
 		}
 	} else if (switches->Import) {
+		/* Truecolor bitmaps are mapped to the exporting palette */
+		if (strcmp("", switches->PalettePath)) {
+			if (!bmp256_setpalette(switches->PalettePath))
+				quit("Could not open palette bitmap %s\n",
+						switches->PalettePath);
+		}
+
+		/* The tables for mapping them are only kept if asked to */
+		if (strcmp("", switches->LutCachePath))
+			bmp256_setlutcache(switches->LutCachePath);
+
 		/* Import all data */
 		if (switches->EpisodeDefPath) {
 			if (parse_definition_file(switches->EpisodeDefPath,
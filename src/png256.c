@@ -0,0 +1,1035 @@
+/* PNG256.C - Indexed PNG loading and saving routines.
+**
+** Copyright (c)2016-2017 by Owen Pierce
+**
+** This software is provided 'as-is', without any express or implied warranty.
+** In no event will the authors be held liable for any damages arising from
+** the use of this software.
+** Permission is granted to anyone to use this software for any purpose, including
+** commercial applications, and to alter it and redistribute it freely, subject
+** to the following restrictions:
+**    1. The origin of this software must not be misrepresented; you must not
+**       claim that you wrote the original software. If you use this software in
+**       a product, an acknowledgment in the product documentation would be
+**       appreciated but is not required.
+**    2. Altered source versions must be plainly marked as such, and must not be
+**       misrepresented as being the original software.
+**    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bmp256.h"
+#include "png256.h"
+
+/* PNG colour type for palettized images */
+#define PNG_PALETTE 3
+/* Largest width or height accepted when loading */
+#define PNG_MAX_DIM 0x100000
+
+static const uint8_t PngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+
+/* Checksums */
+
+static uint32_t CrcTable[256];
+static int CrcInitialised = 0;
+
+static void png256_init_crc(void) {
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		CrcTable[i] = c;
+	}
+	CrcInitialised = 1;
+}
+
+static uint32_t png256_crc(const uint8_t *data, unsigned long len) {
+	uint32_t c = 0xFFFFFFFF;
+	unsigned long i;
+
+	if (!CrcInitialised)
+		png256_init_crc();
+	for (i = 0; i < len; i++)
+		c = CrcTable[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+	return c ^ 0xFFFFFFFF;
+}
+
+static uint32_t png256_adler(const uint8_t *data, unsigned long len) {
+	uint32_t a = 1, b = 0;
+	unsigned long i, n;
+
+	/* 5552 bytes is the most that can be summed before b overflows */
+	while (len) {
+		n = (len < 5552) ? len : 5552;
+		for (i = 0; i < n; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += n;
+		len -= n;
+	}
+	return b << 16 | a;
+}
+
+static void png256_put32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t png256_get32(const uint8_t *p) {
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+
+/* Tables shared by deflate and inflate */
+
+#define LITLEN_CODES 288
+#define DIST_CODES 32
+#define CODELEN_CODES 19
+#define MAX_BITS 15
+
+static const uint16_t LenBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LenExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DistBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DistExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* The order code length code lengths are sent in */
+static const uint8_t CodeLenOrder[CODELEN_CODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* The lengths of the fixed Huffman codes */
+static void png256_fixed_lengths(uint8_t *litlen, uint8_t *dist) {
+	int i;
+
+	for (i = 0; i < 144; i++)
+		litlen[i] = 8;
+	for (; i < 256; i++)
+		litlen[i] = 9;
+	for (; i < 280; i++)
+		litlen[i] = 7;
+	for (; i < LITLEN_CODES; i++)
+		litlen[i] = 8;
+	for (i = 0; i < DIST_CODES; i++)
+		dist[i] = 5;
+}
+
+
+/* Deflate */
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+/* How many earlier positions to try for each match */
+#define MAX_CHAIN 64
+/* Matches this long are taken without looking one byte further */
+#define LAZY_LIMIT 32
+/* Symbols gathered before a block is written */
+#define BLOCK_SYMBOLS 16384
+
+typedef struct {
+	uint8_t *out;
+	unsigned long pos, size;
+	uint64_t bits;
+	int count;
+} BitWriter;
+
+/* Length code for each match length, and distance code for each distance */
+static uint8_t LenCode[MAX_MATCH + 1];
+static uint8_t DistCode[WINDOW_SIZE + 1];
+static int DeflateInitialised = 0;
+
+static void png256_init_deflate(void) {
+	int i, n;
+
+	for (i = 0; i < 29; i++)
+		for (n = LenBase[i]; n < ((i < 28) ? LenBase[i] + (1 << LenExtra[i]) : MAX_MATCH + 1); n++)
+			LenCode[n] = i;
+	for (i = 0; i < 30; i++)
+		for (n = DistBase[i]; n < DistBase[i] + (1 << DistExtra[i]) && n <= WINDOW_SIZE; n++)
+			DistCode[n] = i;
+	DeflateInitialised = 1;
+}
+
+static void png256_putbits(BitWriter *bw, uint32_t value, int n) {
+	bw->bits |= (uint64_t) value << bw->count;
+	bw->count += n;
+	while (bw->count >= 8) {
+		bw->out[bw->pos++] = (uint8_t) bw->bits;
+		bw->bits >>= 8;
+		bw->count -= 8;
+	}
+}
+
+/* Make sure there's room for n more bytes */
+static int png256_reserve(BitWriter *bw, unsigned long n) {
+	uint8_t *out;
+	unsigned long size;
+
+	if (bw->pos + n <= bw->size)
+		return 1;
+	size = bw->size * 2 + n;
+	out = (uint8_t *) realloc(bw->out, size);
+	if (!out)
+		return 0;
+	bw->out = out;
+	bw->size = size;
+	return 1;
+}
+
+/* Work out Huffman code lengths of at most limit bits for the symbols that
+** occur. At least two symbols always get a code, so the code is complete. */
+static void png256_build_lengths(const uint32_t *freq, int n, int limit, uint8_t *lens) {
+	int sym[LITLEN_CODES], parent[2 * LITLEN_CODES];
+	uint32_t weight[2 * LITLEN_CODES];
+	int depth[2 * LITLEN_CODES];
+	int blcount[2 * LITLEN_CODES + 1];
+	int count, i, j, k, leaf, node, pick, len, maxlen, t;
+	uint32_t total;
+
+	memset(lens, 0, n);
+	count = 0;
+	for (i = 0; i < n; i++)
+		if (freq[i])
+			sym[count++] = i;
+	/* Pad with unused symbols up to two */
+	for (i = 0; count < 2 && i < n; i++)
+		if (!freq[i])
+			sym[count++] = i;
+
+	/* Sort the symbols by frequency */
+	for (i = 1; i < count; i++) {
+		t = sym[i];
+		for (j = i; j > 0 && freq[sym[j - 1]] > freq[t]; j--)
+			sym[j] = sym[j - 1];
+		sym[j] = t;
+	}
+
+	/* Two queues: the sorted leaves, and the internal nodes in the order
+	** they are made, which is also by weight */
+	for (i = 0; i < count; i++)
+		weight[i] = freq[sym[i]];
+	leaf = 0;
+	node = count;
+	for (k = count; k < 2 * count - 1; k++) {
+		weight[k] = 0;
+		for (j = 0; j < 2; j++) {
+			if (leaf < count && (node >= k || weight[leaf] <= weight[node]))
+				pick = leaf++;
+			else
+				pick = node++;
+			weight[k] += weight[pick];
+			parent[pick] = k;
+		}
+	}
+	depth[2 * count - 2] = 0;
+	for (k = 2 * count - 3; k >= 0; k--)
+		depth[k] = depth[parent[k]] + 1;
+
+	/* Count the codes of each length, folding any that are too long */
+	memset(blcount, 0, sizeof (blcount));
+	maxlen = 0;
+	for (i = 0; i < count; i++) {
+		blcount[depth[i]]++;
+		if (depth[i] > maxlen)
+			maxlen = depth[i];
+	}
+	for (i = limit + 1; i <= maxlen; i++) {
+		blcount[limit] += blcount[i];
+		blcount[i] = 0;
+	}
+	total = 0;
+	for (i = 1; i <= limit; i++)
+		total += (uint32_t) blcount[i] << (limit - i);
+	while (total > (1U << limit)) {
+		/* Lengthen a shorter code to make room */
+		blcount[limit]--;
+		for (i = limit - 1; i > 0; i--) {
+			if (blcount[i]) {
+				blcount[i]--;
+				blcount[i + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	/* The rarest symbols get the longest codes */
+	j = 0;
+	for (len = limit; len > 0; len--)
+		for (k = 0; k < blcount[len]; k++)
+			lens[sym[j++]] = len;
+}
+
+/* Canonical codes for a set of lengths, bit-reversed to be sent LSB first */
+static void png256_build_codes(const uint8_t *lens, int n, uint16_t *codes) {
+	int blcount[MAX_BITS + 1], next[MAX_BITS + 1];
+	int i, len, code, rev, b;
+
+	memset(blcount, 0, sizeof (blcount));
+	for (i = 0; i < n; i++)
+		blcount[lens[i]]++;
+	blcount[0] = 0;
+	code = 0;
+	for (len = 1; len <= MAX_BITS; len++) {
+		code = (code + blcount[len - 1]) << 1;
+		next[len] = code;
+	}
+	for (i = 0; i < n; i++) {
+		len = lens[i];
+		if (!len)
+			continue;
+		code = next[len]++;
+		rev = 0;
+		for (b = 0; b < len; b++)
+			rev |= ((code >> b) & 1) << (len - 1 - b);
+		codes[i] = rev;
+	}
+}
+
+/* Run-length encode the code lengths with codes 16, 17 and 18 */
+static int png256_pack_lengths(const uint8_t *lens, int n, uint8_t *out, uint8_t *extra) {
+	int i, run, count = 0;
+
+	for (i = 0; i < n; i += run) {
+		for (run = 1; i + run < n && lens[i + run] == lens[i]; run++)
+			;
+		if (lens[i] == 0 && run >= 11) {
+			if (run > 138)
+				run = 138;
+			out[count] = 18;
+			extra[count++] = run - 11;
+		} else if (lens[i] == 0 && run >= 3) {
+			out[count] = 17;
+			extra[count++] = run - 3;
+		} else if (run >= 4) {
+			/* Send the length itself, then repeat it */
+			if (run > 7)
+				run = 7;
+			out[count] = lens[i];
+			extra[count++] = 0;
+			out[count] = 16;
+			extra[count++] = run - 4;
+		} else {
+			run = 1;
+			out[count] = lens[i];
+			extra[count++] = 0;
+		}
+	}
+	return count;
+}
+
+/* Write one block of gathered symbols, with whichever of the fixed and
+** the dynamic codes is smaller */
+static int png256_write_block(BitWriter *bw, const uint16_t *syms, const uint16_t *dists,
+		unsigned count, int last, unsigned long inlen) {
+	uint32_t litfreq[LITLEN_CODES], distfreq[DIST_CODES], clfreq[CODELEN_CODES];
+	uint8_t litlens[LITLEN_CODES], distlens[DIST_CODES], cllens[CODELEN_CODES];
+	uint8_t fixedlit[LITLEN_CODES], fixeddist[DIST_CODES];
+	uint8_t alllens[LITLEN_CODES + DIST_CODES], packed[LITLEN_CODES + DIST_CODES], packextra[LITLEN_CODES + DIST_CODES];
+	uint16_t litcodes[LITLEN_CODES], distcodes[DIST_CODES], clcodes[CODELEN_CODES];
+	static const uint8_t clextra[3] = {2, 3, 7};
+	unsigned long dynbits, fixedbits;
+	unsigned i, s, d;
+	int hlit, hdist, hclen, npacked, dynamic;
+
+	/* Count the symbols */
+	memset(litfreq, 0, sizeof (litfreq));
+	memset(distfreq, 0, sizeof (distfreq));
+	for (i = 0; i < count; i++) {
+		if (dists[i]) {
+			litfreq[257 + LenCode[syms[i]]]++;
+			distfreq[DistCode[dists[i]]]++;
+		} else {
+			litfreq[syms[i]]++;
+		}
+	}
+	litfreq[256] = 1;
+
+	/* Dynamic codes, and the code length code that describes them */
+	png256_build_lengths(litfreq, 286, MAX_BITS, litlens);
+	litlens[286] = litlens[287] = 0;
+	png256_build_lengths(distfreq, 30, MAX_BITS, distlens);
+	distlens[30] = distlens[31] = 0;
+	for (hlit = 286; hlit > 257 && !litlens[hlit - 1]; hlit--)
+		;
+	for (hdist = 30; hdist > 1 && !distlens[hdist - 1]; hdist--)
+		;
+	memcpy(alllens, litlens, hlit);
+	memcpy(alllens + hlit, distlens, hdist);
+	npacked = png256_pack_lengths(alllens, hlit + hdist, packed, packextra);
+	memset(clfreq, 0, sizeof (clfreq));
+	for (i = 0; i < (unsigned) npacked; i++)
+		clfreq[packed[i]]++;
+	png256_build_lengths(clfreq, CODELEN_CODES, 7, cllens);
+	for (hclen = CODELEN_CODES; hclen > 4 && !cllens[CodeLenOrder[hclen - 1]]; hclen--)
+		;
+
+	/* Compare the sizes; the extra bits are the same either way */
+	png256_fixed_lengths(fixedlit, fixeddist);
+	dynbits = 14 + 3 * hclen;
+	for (i = 0; i < (unsigned) npacked; i++)
+		dynbits += cllens[packed[i]] + (packed[i] >= 16 ? clextra[packed[i] - 16] : 0);
+	fixedbits = 0;
+	for (i = 0; i < 286; i++) {
+		dynbits += litfreq[i] * litlens[i];
+		fixedbits += litfreq[i] * fixedlit[i];
+	}
+	for (i = 0; i < 30; i++) {
+		dynbits += distfreq[i] * distlens[i];
+		fixedbits += distfreq[i] * fixeddist[i];
+	}
+	dynamic = dynbits < fixedbits;
+
+	/* Each input byte costs at most 15 bits, and the header a few hundred bytes */
+	if (!png256_reserve(bw, inlen * 2 + 1024))
+		return 0;
+
+	png256_putbits(bw, last, 1);
+	png256_putbits(bw, dynamic ? 2 : 1, 2);
+	if (dynamic) {
+		png256_putbits(bw, hlit - 257, 5);
+		png256_putbits(bw, hdist - 1, 5);
+		png256_putbits(bw, hclen - 4, 4);
+		for (i = 0; i < (unsigned) hclen; i++)
+			png256_putbits(bw, cllens[CodeLenOrder[i]], 3);
+		png256_build_codes(cllens, CODELEN_CODES, clcodes);
+		for (i = 0; i < (unsigned) npacked; i++) {
+			png256_putbits(bw, clcodes[packed[i]], cllens[packed[i]]);
+			if (packed[i] >= 16)
+				png256_putbits(bw, packextra[i], clextra[packed[i] - 16]);
+		}
+	} else {
+		memcpy(litlens, fixedlit, sizeof (litlens));
+		memcpy(distlens, fixeddist, sizeof (distlens));
+	}
+	png256_build_codes(litlens, LITLEN_CODES, litcodes);
+	png256_build_codes(distlens, DIST_CODES, distcodes);
+
+	for (i = 0; i < count; i++) {
+		if (dists[i]) {
+			s = LenCode[syms[i]];
+			d = DistCode[dists[i]];
+			png256_putbits(bw, litcodes[257 + s], litlens[257 + s]);
+			png256_putbits(bw, syms[i] - LenBase[s], LenExtra[s]);
+			png256_putbits(bw, distcodes[d], distlens[d]);
+			png256_putbits(bw, dists[i] - DistBase[d], DistExtra[d]);
+		} else {
+			png256_putbits(bw, litcodes[syms[i]], litlens[syms[i]]);
+		}
+	}
+	png256_putbits(bw, litcodes[256], litlens[256]);
+	return 1;
+}
+
+static unsigned png256_hash(const uint8_t *p) {
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* Find the longest earlier match for the bytes at pos */
+static unsigned png256_find_match(const uint8_t *data, unsigned long len, unsigned long pos,
+		const int32_t *head, const int32_t *prev, unsigned *dist) {
+	unsigned long maxlen;
+	unsigned best = 0, l, chain;
+	int32_t cand;
+
+	if (pos + MIN_MATCH > len)
+		return 0;
+	maxlen = len - pos;
+	if (maxlen > MAX_MATCH)
+		maxlen = MAX_MATCH;
+
+	cand = head[png256_hash(data + pos)];
+	for (chain = 0; cand >= 0 && pos - cand <= WINDOW_SIZE && chain < MAX_CHAIN; chain++) {
+		if (data[cand + best] == data[pos + best]) {
+			for (l = 0; l < maxlen && data[cand + l] == data[pos + l]; l++)
+				;
+			if (l > best) {
+				best = l;
+				*dist = pos - cand;
+				if (l == maxlen)
+					break;
+			}
+		}
+		cand = prev[cand & WINDOW_MASK];
+	}
+	return (best >= MIN_MATCH) ? best : 0;
+}
+
+unsigned char *png256_deflate(const unsigned char *data, unsigned long len, unsigned long *complen) {
+	BitWriter bw;
+	int32_t *head, *prev;
+	uint16_t *syms, *dists;
+	unsigned long pos, start, end;
+	unsigned count, mlen, mdist, nlen, ndist;
+	uint32_t adler;
+
+	if (!DeflateInitialised)
+		png256_init_deflate();
+
+	head = (int32_t *) malloc(HASH_SIZE * sizeof (int32_t));
+	prev = (int32_t *) malloc(WINDOW_SIZE * sizeof (int32_t));
+	syms = (uint16_t *) malloc(BLOCK_SYMBOLS * sizeof (uint16_t));
+	dists = (uint16_t *) malloc(BLOCK_SYMBOLS * sizeof (uint16_t));
+	bw.size = len / 2 + 1024;
+	bw.out = (uint8_t *) malloc(bw.size);
+	if (!head || !prev || !syms || !dists || !bw.out) {
+		free(head);
+		free(prev);
+		free(syms);
+		free(dists);
+		free(bw.out);
+		return NULL;
+	}
+	memset(head, 0xFF, HASH_SIZE * sizeof (int32_t));
+	bw.pos = 0;
+	bw.bits = 0;
+	bw.count = 0;
+
+	/* zlib header: deflate with a 32K window, default compression */
+	png256_putbits(&bw, 0x78, 8);
+	png256_putbits(&bw, 0x9C, 8);
+
+	pos = 0;
+	do {
+		/* Gather a block of literals and matches, looking one byte ahead
+		** for a longer match before taking a short one */
+		start = pos;
+		count = 0;
+		while (pos < len && count < BLOCK_SYMBOLS) {
+			mlen = png256_find_match(data, len, pos, head, prev, &mdist);
+			if (pos + MIN_MATCH <= len) {
+				prev[pos & WINDOW_MASK] = head[png256_hash(data + pos)];
+				head[png256_hash(data + pos)] = pos;
+			}
+			if (mlen && mlen < LAZY_LIMIT) {
+				nlen = png256_find_match(data, len, pos + 1, head, prev, &ndist);
+				if (nlen > mlen)
+					mlen = 0;
+			}
+			if (!mlen) {
+				syms[count] = data[pos];
+				dists[count++] = 0;
+				pos++;
+				continue;
+			}
+			syms[count] = mlen;
+			dists[count++] = mdist;
+			for (end = pos + mlen, pos++; pos < end; pos++) {
+				if (pos + MIN_MATCH <= len) {
+					prev[pos & WINDOW_MASK] = head[png256_hash(data + pos)];
+					head[png256_hash(data + pos)] = pos;
+				}
+			}
+		}
+		if (!png256_write_block(&bw, syms, dists, count, pos >= len, pos - start))
+			break;
+	} while (pos < len);
+
+	free(head);
+	free(prev);
+	free(syms);
+	free(dists);
+	if (pos < len || !png256_reserve(&bw, 8)) {
+		free(bw.out);
+		return NULL;
+	}
+
+	/* Finish the last byte, then the Adler-32 of the data */
+	if (bw.count)
+		png256_putbits(&bw, 0, 8 - bw.count);
+	adler = png256_adler(data, len);
+	png256_put32(bw.out + bw.pos, adler);
+	*complen = bw.pos + 4;
+	return bw.out;
+}
+
+
+/* Inflate */
+
+/* Codes up to this long are decoded with one table lookup */
+#define FAST_BITS 9
+
+typedef struct {
+	uint16_t fast[1 << FAST_BITS];	/* symbol | length << 9, or 0 */
+	uint16_t count[MAX_BITS + 1];
+	uint16_t symbol[LITLEN_CODES];
+} HuffTable;
+
+typedef struct {
+	const uint8_t *in;
+	unsigned long pos, len;
+	uint64_t bits;
+	int count;
+	int overrun;
+} BitReader;
+
+static void png256_refill(BitReader *br) {
+	while (br->count <= 56 && br->pos < br->len) {
+		br->bits |= (uint64_t) br->in[br->pos++] << br->count;
+		br->count += 8;
+	}
+}
+
+/* Past the end of the data, zeros are read and the overrun noted */
+static uint32_t png256_getbits(BitReader *br, int n) {
+	uint32_t v;
+
+	if (!n)
+		return 0;
+	if (br->count < n) {
+		png256_refill(br);
+		if (br->count < n) {
+			br->overrun = 1;
+			br->count = n;
+		}
+	}
+	v = (uint32_t) br->bits & ((1U << n) - 1);
+	br->bits >>= n;
+	br->count -= n;
+	return v;
+}
+
+/* Returns 0 if the lengths are over-subscribed */
+static int png256_build_table(HuffTable *h, const uint8_t *lens, int n) {
+	uint16_t offs[MAX_BITS + 1], codes[LITLEN_CODES];
+	int i, len, left, fill;
+
+	memset(h->count, 0, sizeof (h->count));
+	for (i = 0; i < n; i++)
+		h->count[lens[i]]++;
+	h->count[0] = 0;
+	left = 1;
+	for (len = 1; len <= MAX_BITS; len++) {
+		left = (left << 1) - h->count[len];
+		if (left < 0)
+			return 0;
+	}
+
+	/* Symbols in canonical order, for the slow path */
+	offs[1] = 0;
+	for (len = 1; len < MAX_BITS; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (i = 0; i < n; i++)
+		if (lens[i])
+			h->symbol[offs[lens[i]]++] = i;
+
+	/* Short codes fill every table slot that starts with them */
+	memset(h->fast, 0, sizeof (h->fast));
+	png256_build_codes(lens, n, codes);
+	for (i = 0; i < n; i++) {
+		len = lens[i];
+		if (!len || len > FAST_BITS)
+			continue;
+		for (fill = codes[i]; fill < (1 << FAST_BITS); fill += 1 << len)
+			h->fast[fill] = i | len << 9;
+	}
+	return 1;
+}
+
+/* Returns -1 for a code that isn't in the table */
+static int png256_decode_symbol(BitReader *br, const HuffTable *h) {
+	int code, first, index, count, len, entry;
+
+	if (br->count < MAX_BITS)
+		png256_refill(br);
+	entry = h->fast[br->bits & ((1 << FAST_BITS) - 1)];
+	if (entry) {
+		if ((entry >> 9) > br->count) {
+			br->overrun = 1;
+			br->count = entry >> 9;
+		}
+		br->bits >>= entry >> 9;
+		br->count -= entry >> 9;
+		return entry & 0x1FF;
+	}
+
+	/* Walk the canonical code a bit at a time */
+	code = first = index = 0;
+	for (len = 1; len <= MAX_BITS; len++) {
+		code |= png256_getbits(br, 1);
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+/* Read the code lengths of a dynamic block */
+static int png256_read_dynamic(BitReader *br, HuffTable *lit, HuffTable *dist) {
+	uint8_t lens[LITLEN_CODES + DIST_CODES], cllens[CODELEN_CODES];
+	HuffTable cl;
+	int hlit, hdist, hclen, i, sym, rep, val;
+
+	hlit = png256_getbits(br, 5) + 257;
+	hdist = png256_getbits(br, 5) + 1;
+	hclen = png256_getbits(br, 4) + 4;
+	if (hlit > 286 || hdist > 30)
+		return 0;
+	memset(cllens, 0, sizeof (cllens));
+	for (i = 0; i < hclen; i++)
+		cllens[CodeLenOrder[i]] = png256_getbits(br, 3);
+	if (!png256_build_table(&cl, cllens, CODELEN_CODES))
+		return 0;
+
+	for (i = 0; i < hlit + hdist; ) {
+		sym = png256_decode_symbol(br, &cl);
+		if (sym < 0)
+			return 0;
+		if (sym < 16) {
+			lens[i++] = sym;
+			continue;
+		}
+		if (sym == 16) {
+			if (!i)
+				return 0;
+			val = lens[i - 1];
+			rep = 3 + png256_getbits(br, 2);
+		} else if (sym == 17) {
+			val = 0;
+			rep = 3 + png256_getbits(br, 3);
+		} else {
+			val = 0;
+			rep = 11 + png256_getbits(br, 7);
+		}
+		if (i + rep > hlit + hdist)
+			return 0;
+		while (rep--)
+			lens[i++] = val;
+	}
+	if (!lens[256])
+		return 0;
+	return png256_build_table(lit, lens, hlit) && png256_build_table(dist, lens + hlit, hdist);
+}
+
+long png256_inflate(const unsigned char *data, unsigned long len, unsigned char *out, unsigned long outlen) {
+	BitReader br;
+	HuffTable *lit, *dist;
+	uint8_t fixedlit[LITLEN_CODES], fixeddist[DIST_CODES];
+	unsigned long pos = 0, n, d;
+	uint32_t adler;
+	int last, type, sym, i, ok = 1;
+
+	/* zlib header: deflate, no preset dictionary */
+	if (len < 6 || (data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 ||
+			((data[0] << 8) | data[1]) % 31 || (data[1] & 0x20))
+		return -1;
+
+	lit = (HuffTable *) malloc(2 * sizeof (HuffTable));
+	if (!lit)
+		return -1;
+	dist = lit + 1;
+
+	br.in = data + 2;
+	br.len = len - 2;
+	br.pos = 0;
+	br.bits = 0;
+	br.count = 0;
+	br.overrun = 0;
+
+	do {
+		last = png256_getbits(&br, 1);
+		type = png256_getbits(&br, 2);
+		if (type == 0) {
+			/* Stored: skip to a byte boundary, then copy */
+			png256_getbits(&br, br.count & 7);
+			n = png256_getbits(&br, 16);
+			if ((png256_getbits(&br, 16) ^ 0xFFFF) != n || n > outlen - pos) {
+				ok = 0;
+				break;
+			}
+			for (; n && br.count >= 8; n--)
+				out[pos++] = png256_getbits(&br, 8);
+			if (n > br.len - br.pos) {
+				ok = 0;
+				break;
+			}
+			memcpy(out + pos, br.in + br.pos, n);
+			pos += n;
+			br.pos += n;
+			continue;
+		}
+		if (type == 1) {
+			png256_fixed_lengths(fixedlit, fixeddist);
+			png256_build_table(lit, fixedlit, LITLEN_CODES);
+			png256_build_table(dist, fixeddist, DIST_CODES);
+		} else if (type != 2 || !png256_read_dynamic(&br, lit, dist)) {
+			ok = 0;
+			break;
+		}
+
+		for (;;) {
+			sym = png256_decode_symbol(&br, lit);
+			if (sym < 256) {
+				if (sym < 0 || pos >= outlen) {
+					ok = 0;
+					break;
+				}
+				out[pos++] = sym;
+				continue;
+			}
+			if (sym == 256)
+				break;
+			sym -= 257;
+			if (sym >= 29) {
+				ok = 0;
+				break;
+			}
+			n = LenBase[sym] + png256_getbits(&br, LenExtra[sym]);
+			sym = png256_decode_symbol(&br, dist);
+			if (sym < 0 || sym >= 30) {
+				ok = 0;
+				break;
+			}
+			d = DistBase[sym] + png256_getbits(&br, DistExtra[sym]);
+			if (d > pos || n > outlen - pos) {
+				ok = 0;
+				break;
+			}
+			/* Copy forwards, so overlapping matches repeat */
+			for (; n; n--, pos++)
+				out[pos] = out[pos - d];
+		}
+	} while (ok && !last && !br.overrun);
+
+	free(lit);
+	if (!ok || br.overrun)
+		return -1;
+
+	/* Check the Adler-32 that follows the last block */
+	png256_getbits(&br, br.count & 7);
+	adler = 0;
+	for (i = 0; i < 4; i++)
+		adler = adler << 8 | png256_getbits(&br, 8);
+	if (br.overrun || adler != png256_adler(out, pos))
+		return -1;
+	return pos;
+}
+
+
+/* PNG files */
+
+int png256_signature(const unsigned char *data, unsigned long size) {
+	return size >= sizeof (PngSignature) && !memcmp(data, PngSignature, sizeof (PngSignature));
+}
+
+/* Append a chunk; data may already be in place at p + 8 */
+static uint8_t *png256_put_chunk(uint8_t *p, const char *type, const uint8_t *data, unsigned long len) {
+	png256_put32(p, len);
+	memcpy(p + 4, type, 4);
+	if (len && data != p + 8)
+		memcpy(p + 8, data, len);
+	png256_put32(p + 8 + len, png256_crc(p + 4, len + 4));
+	return p + 12 + len;
+}
+
+unsigned char *png256_encode(BITMAP256 *bmp, unsigned long *size) {
+	uint8_t header[13], palette[256 * 3];
+	const unsigned char *quads;
+	uint8_t *raw, *zdata, *buf, *p;
+	unsigned long rowbytes, rawlen, zlen;
+	int colors, i, y;
+
+	/* PNG has no way to store an empty image */
+	if (!bmp->width || !bmp->height)
+		return NULL;
+
+	/* Every row starts with its filter type; none, as suits palettes */
+	rowbytes = ((unsigned long) bmp->width * bmp->bpp + 7) / 8;
+	rawlen = (rowbytes + 1) * bmp->height;
+	raw = (uint8_t *) malloc(rawlen);
+	if (!raw)
+		return NULL;
+	for (y = 0; y < bmp->height; y++) {
+		raw[y * (rowbytes + 1)] = 0;
+		memcpy(raw + y * (rowbytes + 1) + 1, bmp->lines[y], rowbytes);
+	}
+	zdata = png256_deflate(raw, rawlen, &zlen);
+	free(raw);
+	if (!zdata)
+		return NULL;
+
+	/* The same colours a BMP of this depth gets */
+	colors = 1 << bmp->bpp;
+	quads = bmp256_palette(bmp->bpp);
+	for (i = 0; i < colors; i++) {
+		palette[i * 3] = quads[i * 4 + 2];
+		palette[i * 3 + 1] = quads[i * 4 + 1];
+		palette[i * 3 + 2] = quads[i * 4];
+	}
+
+	png256_put32(header, bmp->width);
+	png256_put32(header + 4, bmp->height);
+	header[8] = bmp->bpp;
+	header[9] = PNG_PALETTE;
+	header[10] = 0;	/* deflate */
+	header[11] = 0;	/* adaptive filters */
+	header[12] = 0;	/* not interlaced */
+
+	*size = sizeof (PngSignature) + (12 + sizeof (header)) + (12 + colors * 3) + (12 + zlen) + 12;
+	buf = (uint8_t *) malloc(*size);
+	if (!buf) {
+		free(zdata);
+		return NULL;
+	}
+	memcpy(buf, PngSignature, sizeof (PngSignature));
+	p = buf + sizeof (PngSignature);
+	p = png256_put_chunk(p, "IHDR", header, sizeof (header));
+	p = png256_put_chunk(p, "PLTE", palette, colors * 3);
+	p = png256_put_chunk(p, "IDAT", zdata, zlen);
+	png256_put_chunk(p, "IEND", NULL, 0);
+	free(zdata);
+	return buf;
+}
+
+static int png256_paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+	return (pb <= pc) ? b : c;
+}
+
+/* Undo the row filters in place. Pixels are at most a byte, so the byte to
+** the left is the previous pixel. */
+static int png256_unfilter(uint8_t *raw, unsigned long rowbytes, unsigned height) {
+	uint8_t *row, *prior = NULL;
+	unsigned long x;
+	unsigned y;
+	int a, b, c;
+
+	for (y = 0; y < height; y++) {
+		row = raw + y * (rowbytes + 1) + 1;
+		for (x = 0; x < rowbytes; x++) {
+			a = x ? row[x - 1] : 0;
+			b = prior ? prior[x] : 0;
+			c = (x && prior) ? prior[x - 1] : 0;
+			switch (row[-1]) {
+				case 0:
+					break;
+				case 1:
+					row[x] += a;
+					break;
+				case 2:
+					row[x] += b;
+					break;
+				case 3:
+					row[x] += (a + b) / 2;
+					break;
+				case 4:
+					row[x] += png256_paeth(a, b, c);
+					break;
+				default:
+					return 0;
+			}
+		}
+		prior = row;
+	}
+	return 1;
+}
+
+BITMAP256 *png256_decode(const unsigned char *data, unsigned long size) {
+	BITMAP256 *bmp = NULL;
+	const uint8_t *p, *end, *header = NULL;
+	uint8_t *zdata = NULL, *raw = NULL;
+	unsigned long len, zlen = 0, rowbytes, rawlen;
+	uint32_t width = 0, height = 0;
+	int depth = 0, y;
+
+	if (!png256_signature(data, size))
+		return NULL;
+
+	/* First pass: check the chunks and total up the image data */
+	p = data + sizeof (PngSignature);
+	end = data + size;
+	while (end - p >= 12) {
+		len = png256_get32(p);
+		if (len > (unsigned long) (end - p) - 12)
+			return NULL;
+		if (png256_get32(p + 8 + len) != png256_crc(p + 4, len + 4))
+			return NULL;
+		if (!memcmp(p + 4, "IHDR", 4) && len == 13)
+			header = p + 8;
+		else if (!memcmp(p + 4, "IDAT", 4))
+			zlen += len;
+		else if (!memcmp(p + 4, "IEND", 4))
+			break;
+		p += 12 + len;
+	}
+
+	/* Only palettized, non-interlaced images; the palette is ignored like
+	** a BMP's, since the pixels are colour indices */
+	if (!header)
+		return NULL;
+	width = png256_get32(header);
+	height = png256_get32(header + 4);
+	depth = header[8];
+	if (width == 0 || width > PNG_MAX_DIM || height == 0 || height > PNG_MAX_DIM ||
+			(depth != 1 && depth != 2 && depth != 4 && depth != 8) ||
+			header[9] != PNG_PALETTE || header[10] || header[11] || header[12])
+		return NULL;
+
+	/* Second pass: join the image data */
+	zdata = (uint8_t *) malloc(zlen ? zlen : 1);
+	rowbytes = ((unsigned long) width * depth + 7) / 8;
+	rawlen = (rowbytes + 1) * height;
+	raw = (uint8_t *) malloc(rawlen);
+	if (!zdata || !raw)
+		goto done;
+	zlen = 0;
+	p = data + sizeof (PngSignature);
+	while (end - p >= 12 && memcmp(p + 4, "IEND", 4)) {
+		len = png256_get32(p);
+		if (!memcmp(p + 4, "IDAT", 4)) {
+			memcpy(zdata + zlen, p + 8, len);
+			zlen += len;
+		}
+		p += 12 + len;
+	}
+
+	if (png256_inflate(zdata, zlen, raw, rawlen) != (long) rawlen)
+		goto done;
+	if (!png256_unfilter(raw, rowbytes, height))
+		goto done;
+
+	bmp = bmp256_create(width, height, depth);
+	if (!bmp)
+		goto done;
+	for (y = 0; y < bmp->height; y++)
+		memcpy(bmp->lines[y], raw + y * (rowbytes + 1) + 1, rowbytes);
+
+done:
+	free(zdata);
+	free(raw);
+	return bmp;
+}
@@ -0,0 +1,1295 @@
+/* SELFTEST.C - Codec self-test and benchmark routines.
+**
+** Copyright (c)2016-2017 by Owen Pierce
+**
+** This software is provided 'as-is', without any express or implied warranty.
+** In no event will the authors be held liable for any damages arising from
+** the use of this software.
+** Permission is granted to anyone to use this software for any purpose, including
+** commercial applications, and to alter it and redistribute it freely, subject
+** to the following restrictions:
+**    1. The origin of this software must not be misrepresented; you must not
+**       claim that you wrote the original software. If you use this software in
+**       a product, an acknowledgment in the product documentation would be
+**       appreciated but is not required.
+**    2. Altered source versions must be plainly marked as such, and must not be
+**       misrepresented as being the original software.
+**    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+#include "huff.h"
+#include "lz.h"
+#include "bmp256.h"
+#include "png256.h"
+#include "utils.h"
+#include "pconio.h"
+#include "selftest.h"
+
+/* Number of generated inputs per codec */
+#define SELFTEST_CASES 400
+/* Longest generated input */
+#define SELFTEST_MAXLEN 65536
+/* Only report this many failures in detail */
+#define SELFTEST_MAX_REPORTS 10
+
+/* Kinds of generated input */
+enum {
+	gen_random,		/* Uniformly random bytes */
+	gen_runs,		/* Long runs of a few values, like planar graphics */
+	gen_skewed,		/* A few very common bytes and a long tail */
+	gen_alphabet,	/* A small random alphabet */
+	gen_ramp,		/* Every byte value in turn */
+	gen_constant,	/* One byte repeated */
+	NUM_GENERATORS
+};
+
+static const char *GeneratorNames[NUM_GENERATORS] = {
+	"random", "runs", "skewed", "alphabet", "ramp", "constant"
+};
+
+/* Kinds of Huffman dictionary tried against the input */
+enum {
+	dict_optimal,	/* Built from the input itself, as -optimizedcomp does */
+	dict_limited,	/* The same, with a random code length limit */
+	dict_random,	/* Built from random counts */
+	dict_deep,		/* Built from Fibonacci counts, so codes are as long as allowed */
+	NUM_DICTIONARIES
+};
+
+static const char *DictionaryNames[NUM_DICTIONARIES] = {
+	"optimal", "limited", "random", "deep"
+};
+
+/* Time spent in each codec, and the number of uncompressed bytes handled */
+typedef struct {
+	const char *name;
+	double seconds;
+	unsigned long bytes;
+} codectimer;
+
+enum {
+	time_huff_compress_bitwise,
+	time_huff_compress,
+	time_huff_expand_tree,
+	time_huff_expand,
+	time_lz_compress_file,
+	time_lz_compress,
+	time_lz_decompress_file,
+	time_lz_decompress,
+	time_plane_split_pixel,
+	time_plane_split,
+	time_plane_merge_pixel,
+	time_plane_merge,
+	time_blit_pixel,
+	time_blit,
+	time_munge_pixel,
+	time_munge,
+	time_demunge_pixel,
+	time_demunge,
+	time_rect_pixel,
+	time_rect,
+	time_deflate,
+	time_inflate,
+	time_quantize_search,
+	time_quantize,
+	NUM_TIMERS
+};
+
+static codectimer Timers[NUM_TIMERS] = {
+	{"Huffman compress (bitwise)", 0, 0},
+	{"Huffman compress", 0, 0},
+	{"Huffman expand (tree)", 0, 0},
+	{"Huffman expand", 0, 0},
+	{"LZ compress (file)", 0, 0},
+	{"LZ compress", 0, 0},
+	{"LZ decompress (file)", 0, 0},
+	{"LZ decompress", 0, 0},
+	{"Plane split (pixel)", 0, 0},
+	{"Plane split", 0, 0},
+	{"Plane merge (pixel)", 0, 0},
+	{"Plane merge", 0, 0},
+	{"Blit (pixel)", 0, 0},
+	{"Blit", 0, 0},
+	{"Mode X munge (pixel)", 0, 0},
+	{"Mode X munge", 0, 0},
+	{"Mode X demunge (pixel)", 0, 0},
+	{"Mode X demunge", 0, 0},
+	{"Rectangle (pixel)", 0, 0},
+	{"Rectangle", 0, 0},
+	{"Deflate", 0, 0},
+	{"Inflate", 0, 0},
+	{"Palette search (pixel)", 0, 0},
+	{"Palette lookup", 0, 0}
+};
+
+static uint32_t RandState;
+static int Failures;
+
+/* A small xorshift generator, so a seed always gives the same inputs */
+static uint32_t selftest_rand(void)
+{
+	RandState ^= RandState << 13;
+	RandState ^= RandState >> 17;
+	RandState ^= RandState << 5;
+	return RandState;
+}
+
+static void selftest_fail(const char *codec, int gen, unsigned long len, const char *what)
+{
+	Failures++;
+	if (Failures <= SELFTEST_MAX_REPORTS)
+	{
+		setcol_error;
+		do_output("\n  %s: %s (%s input, %lu bytes)", codec, what, GeneratorNames[gen], len);
+		setcol_normal;
+	}
+}
+
+static void selftest_time(int timer, clock_t start, unsigned long bytes)
+{
+	Timers[timer].seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+	Timers[timer].bytes += bytes;
+}
+
+static void selftest_generate(int gen, unsigned char *buf, unsigned long len)
+{
+	unsigned char alphabet[16];
+	unsigned long i, run;
+	int n;
+
+	switch (gen)
+	{
+	case gen_random:
+		for (i = 0; i < len; i++)
+			buf[i] = selftest_rand();
+		break;
+
+	case gen_runs:
+		for (i = 0; i < len; i += run)
+		{
+			run = 1 + selftest_rand() % 512;
+			if (run > len - i)
+				run = len - i;
+			memset(buf + i, (selftest_rand() & 1) ? 0x00 : selftest_rand(), run);
+		}
+		break;
+
+	case gen_skewed:
+		for (i = 0; i < len; i++)
+		{
+			n = selftest_rand() % 100;
+			buf[i] = (n < 60) ? 0 : (n < 80) ? 0xFF : (n < 90) ? 0x55 : selftest_rand();
+		}
+		break;
+
+	case gen_alphabet:
+		n = 2 + selftest_rand() % 15;
+		for (i = 0; i < (unsigned long)n; i++)
+			alphabet[i] = selftest_rand();
+		for (i = 0; i < len; i++)
+			buf[i] = alphabet[selftest_rand() % n];
+		break;
+
+	case gen_ramp:
+		for (i = 0; i < len; i++)
+			buf[i] = i;
+		break;
+
+	case gen_constant:
+	default:
+		memset(buf, selftest_rand(), len);
+		break;
+	}
+}
+
+/* Pick an input length, favouring short ones */
+static unsigned long selftest_length(unsigned long maxlen)
+{
+	switch (selftest_rand() % 4)
+	{
+	case 0:
+		return 1 + selftest_rand() % 16;
+	case 1:
+		return 1 + selftest_rand() % 1024;
+	default:
+		return 1 + selftest_rand() % maxlen;
+	}
+}
+
+/* Build the dictionary for one test case. Returns 0 if it couldn't be built. */
+static int selftest_dictionary(HuffContext *ctx, int dict, int counts[])
+{
+	int dictcounts[256];
+	int i, a, b, t;
+
+	switch (dict)
+	{
+	case dict_limited:
+		if (!huff_ctx_huffmanize_limited(ctx, counts, 8 + selftest_rand() % (HUFF_MAX_CODE_BITS - 7)))
+			return 0;
+		break;
+
+	case dict_random:
+		for (i = 0; i < 256; i++)
+			dictcounts[i] = 1 + selftest_rand() % 65536;
+		if (!huff_ctx_huffmanize(ctx, dictcounts))
+			return 0;
+		break;
+
+	case dict_deep:
+		/* Fibonacci counts, capped so the total stays well inside an int */
+		for (a = 1, b = 1, i = 0; i < 256; i++)
+		{
+			dictcounts[i] = a;
+			if (b < (1 << 22))
+			{
+				t = a + b;
+				a = b;
+				b = t;
+			}
+		}
+		if (!huff_ctx_huffmanize_limited(ctx, dictcounts, HUFF_MAX_CODE_BITS))
+			return 0;
+		break;
+
+	case dict_optimal:
+	default:
+		if (!huff_ctx_huffmanize(ctx, counts))
+			return 0;
+		break;
+	}
+
+	if (!huff_ctx_setup_compression(ctx))
+		return 0;
+
+	/* Very skewed counts can give codes too long to compress; limit them as
+	** the importer does */
+	for (i = 0; i < 256; i++)
+	{
+		if (counts[i] && huff_ctx_code_length(ctx, i) > HUFF_MAX_CODE_BITS)
+		{
+			if (!huff_ctx_huffmanize_limited(ctx, counts, HUFF_MAX_CODE_BITS) ||
+			    !huff_ctx_setup_compression(ctx))
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+/* Run one input through both Huffman encoders and both decoders, with room
+** to spare and then with the input or output cut short */
+static void selftest_huff_case(HuffContext *ctx, int gen, unsigned char *data, unsigned long len,
+		unsigned char *comp1, unsigned char *comp2, unsigned char *out1, unsigned char *out2)
+{
+	int counts[256];
+	int dict, trail, i;
+	unsigned long complen, len1, len2, cut;
+	clock_t start;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < (int)len; i++)
+		counts[data[i]]++;
+
+	/* The histogram kernel against a plain count */
+	{
+		int histcounts[256];
+
+		memset(histcounts, 0, sizeof(histcounts));
+		huff_histogram(data, len, histcounts);
+		if (memcmp(histcounts, counts, sizeof(counts)))
+			selftest_fail("huff_histogram", gen, len, "counts differ");
+	}
+
+	dict = selftest_rand() % NUM_DICTIONARIES;
+	if (!selftest_dictionary(ctx, dict, counts))
+	{
+		selftest_fail("Huffman", gen, len, DictionaryNames[dict]);
+		return;
+	}
+	trail = selftest_rand() % 3;
+	complen = huff_ctx_compressed_size(ctx, counts, len, trail);
+
+	start = clock();
+	len1 = huff_ctx_compress_bitwise(ctx, data, comp1, len, complen + 1, trail);
+	selftest_time(time_huff_compress_bitwise, start, len);
+	start = clock();
+	len2 = huff_ctx_compress(ctx, data, comp2, len, complen + 1, trail);
+	selftest_time(time_huff_compress, start, len);
+
+	if (len1 != complen)
+		selftest_fail("huff_ctx_compress_bitwise", gen, len, "length differs from huff_ctx_compressed_size");
+	if (len2 != len1 || memcmp(comp1, comp2, len1))
+		selftest_fail("huff_ctx_compress", gen, len, "output differs from reference");
+
+	start = clock();
+	huff_ctx_expand_tree(ctx, comp1, out1, len1, len);
+	selftest_time(time_huff_expand_tree, start, len);
+	start = clock();
+	huff_ctx_expand(ctx, comp1, out2, len1, len);
+	selftest_time(time_huff_expand, start, len);
+
+	if (memcmp(out1, data, len))
+		selftest_fail("huff_ctx_expand_tree", gen, len, "round trip failed");
+	if (memcmp(out2, data, len))
+		selftest_fail("huff_ctx_expand", gen, len, "round trip failed");
+
+	/* Not enough room for the compressed data */
+	cut = selftest_rand() % (complen + 1);
+	memset(comp1, 0xAA, complen + 1);
+	memset(comp2, 0xAA, complen + 1);
+	len1 = huff_ctx_compress_bitwise(ctx, data, comp1, len, cut, trail);
+	len2 = huff_ctx_compress(ctx, data, comp2, len, cut, trail);
+	if (len2 != len1 || memcmp(comp1, comp2, complen + 1))
+		selftest_fail("huff_ctx_compress", gen, len, "truncated output differs from reference");
+
+	/* Compressed data cut short */
+	huff_ctx_compress_bitwise(ctx, data, comp1, len, complen + 1, trail);
+	cut = 1 + selftest_rand() % complen;
+	memset(out1, 0xAA, len);
+	memset(out2, 0xAA, len);
+	huff_ctx_expand_tree(ctx, comp1, out1, cut, len);
+	huff_ctx_expand(ctx, comp1, out2, cut, len);
+	if (memcmp(out1, out2, len))
+		selftest_fail("huff_ctx_expand", gen, len, "truncated input differs from reference");
+}
+
+/* Run one input through the file and buffer LZ routines, then through the
+** buffer ones with too little room or too little input */
+static void selftest_lz_case(LZContext *ctx, int gen, unsigned char *data, unsigned long len,
+		unsigned char *comp1, unsigned char *comp2, unsigned char *out1, unsigned char *out2)
+{
+	FILE *fin, *fcomp;
+	long complen, complen2, outlen, outlen2;
+	unsigned long cut;
+	clock_t start;
+
+	fin = tmpfile();
+	fcomp = tmpfile();
+	if (!fin || !fcomp)
+		quit("Unable to create temporary files for the LZ test!");
+
+	fwrite(data, len, 1, fin);
+	rewind(fin);
+
+	start = clock();
+	complen = lz_compress(fin, fcomp);
+	selftest_time(time_lz_compress_file, start, len);
+
+	rewind(fcomp);
+	start = clock();
+	outlen = lz_decompress(fcomp, (char *) out1);
+	selftest_time(time_lz_decompress_file, start, len);
+
+	if (outlen != (long)len || memcmp(out1, data, len))
+		selftest_fail("lz_decompress", gen, len, "round trip failed");
+
+	rewind(fcomp);
+	if (complen <= 0 || fread(comp1, 1, complen, fcomp) != (unsigned long)complen)
+	{
+		selftest_fail("lz_compress", gen, len, "no output");
+		complen = 0;
+	}
+	fclose(fin);
+	fclose(fcomp);
+
+	start = clock();
+	complen2 = lz_ctx_compress(ctx, data, len, comp2, LZ_COMPRESS_BOUND(len));
+	selftest_time(time_lz_compress, start, len);
+	if (complen2 != complen || memcmp(comp1, comp2, complen))
+		selftest_fail("lz_ctx_compress", gen, len, "output differs from reference");
+
+	start = clock();
+	outlen2 = lz_ctx_decompress(ctx, comp1, complen, out2, len);
+	selftest_time(time_lz_decompress, start, len);
+	if (outlen2 != (long)len || memcmp(out2, data, len))
+		selftest_fail("lz_ctx_decompress", gen, len, "round trip failed");
+
+	/* A few bytes at a time, as a stream */
+	{
+		unsigned long done = 0, window;
+		long got = 1;
+
+		memset(out2, 0xAA, len);
+		lz_ctx_stream_begin(ctx, comp1, complen);
+		while (got > 0 && done <= len)
+		{
+			window = 1 + selftest_rand() % ((selftest_rand() & 1) ? 16 : 4096);
+			if (window > len + 1 - done)
+				window = len + 1 - done;
+			got = lz_ctx_stream_read(ctx, out2 + done, window);
+			if (got > 0)
+				done += got;
+		}
+		if (got < 0 || done != len || memcmp(out2, data, len))
+			selftest_fail("lz_ctx_stream_read", gen, len, "round trip failed");
+	}
+
+	/* Not enough room for the compressed data */
+	cut = selftest_rand() % complen;
+	if (lz_ctx_compress(ctx, data, len, comp2, cut) != -1)
+		selftest_fail("lz_ctx_compress", gen, len, "didn't notice the output was full");
+
+	/* Not enough room for the decompressed data */
+	cut = selftest_rand() % len;
+	memset(out2, 0xAA, len);
+	outlen2 = lz_ctx_decompress(ctx, comp1, complen, out2, cut);
+	if (outlen2 != (long)cut || memcmp(out2, data, cut) || (cut < len && out2[cut] != 0xAA))
+		selftest_fail("lz_ctx_decompress", gen, len, "overran a short output buffer");
+
+	/* Compressed data cut short: either an error or a prefix of the data
+	** (all of it, if only the end-of-file code was lost) */
+	cut = selftest_rand() % complen;
+	outlen2 = lz_ctx_decompress(ctx, comp1, cut, out2, len);
+	if (outlen2 > (long)len || (outlen2 > 0 && memcmp(out2, data, outlen2)))
+		selftest_fail("lz_ctx_decompress", gen, len, "garbled truncated input");
+}
+
+/* Split a random 4bpp or 8bpp bitmap into 1bpp planes and merge them back,
+** comparing both with the same conversion done a pixel at a time */
+static void selftest_planes_case(void)
+{
+	BITMAP256 *bmp, *merged, *ref, *copy, view;
+	BITMAP256 *planes[8], *refplanes[8];
+	unsigned char *viewlines[16];
+	unsigned width, height, bpp, planestart, planecount, x, y, p;
+	unsigned long size;
+	clock_t start;
+	int c;
+
+	width = 1 + selftest_rand() % 320;
+	height = 1 + selftest_rand() % 16;
+	bpp = (selftest_rand() & 1) ? 8 : 4;
+	planestart = selftest_rand() % bpp;
+	planecount = 1 + selftest_rand() % (bpp - planestart);
+	size = (unsigned long)width * height;
+
+	bmp = bmp256_create(width, height, bpp);
+	if (!bmp)
+		quit("Not enough memory for the self test!");
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			bmp256_putpixel(bmp, x, y, selftest_rand() & 0xFF);
+
+	/* The planes are built a pixel at a time here, as bmp256 used to */
+	start = clock();
+	for (p = 0; p < planecount; p++)
+	{
+		refplanes[p] = bmp256_create(width, height, 1);
+		if (!refplanes[p])
+			quit("Not enough memory for the self test!");
+		for (y = 0; y < height; y++)
+			for (x = 0; x < width; x++)
+				bmp256_putpixel(refplanes[p], x, y, bmp256_getpixel(bmp, x, y) >> (planestart + p));
+	}
+	selftest_time(time_plane_split_pixel, start, size);
+
+	start = clock();
+	if (!bmp256_split_ex(bmp, planes, planestart, planecount))
+		quit("Not enough memory for the self test!");
+	selftest_time(time_plane_split, start, size);
+
+	for (p = 0; p < planecount; p++)
+		if (memcmp(planes[p]->bits, refplanes[p]->bits, refplanes[p]->linewidth * height))
+			break;
+	if (p < planecount)
+		selftest_fail("Plane split", gen_random, size, "planes differ from the reference");
+
+	/* Merge back into the smallest bpp that holds the planes */
+	bpp = (planecount <= 4) ? 4 : 8;
+	start = clock();
+	ref = bmp256_create(width, height, bpp);
+	if (!ref)
+		quit("Not enough memory for the self test!");
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			for (c = 0, p = 0; p < planecount; p++)
+				c |= bmp256_getpixel(refplanes[p], x, y) << p;
+			bmp256_putpixel(ref, x, y, c);
+		}
+	}
+	selftest_time(time_plane_merge_pixel, start, size);
+
+	start = clock();
+	merged = bmp256_merge_ex(planes, planecount, bpp);
+	if (!merged)
+		quit("Not enough memory for the self test!");
+	selftest_time(time_plane_merge, start, size);
+
+	if (memcmp(merged->bits, ref->bits, ref->linewidth * height))
+		selftest_fail("Plane merge", gen_random, size, "pixels differ from the reference");
+
+	/* Split a view of part of the bitmap into the same planes, which must
+	** give what splitting a copy of that part does */
+	x = (selftest_rand() % width) & ~7;
+	y = selftest_rand() % height;
+	view.width = 1 + selftest_rand() % (width - x);
+	view.height = 1 + selftest_rand() % (height - y);
+	if (!bmp256_view(&view, viewlines, bmp, x, y, view.width, view.height))
+		selftest_fail("Bitmap view", gen_random, size, "aligned view refused");
+	else
+	{
+		copy = bmp256_create(view.width, view.height, view.bpp);
+		if (!copy)
+			quit("Not enough memory for the self test!");
+		bmp256_blit(bmp, x, y, copy, 0, 0, view.width, view.height);
+		for (p = 0; p < planecount; p++)
+		{
+			bmp256_free(planes[p]);
+			bmp256_free(refplanes[p]);
+			planes[p] = bmp256_create(view.width, view.height, 1);
+			if (!planes[p])
+				quit("Not enough memory for the self test!");
+		}
+		if (!bmp256_split_ex(copy, refplanes, planestart, planecount))
+			quit("Not enough memory for the self test!");
+		bmp256_split_into(&view, planes, planestart, planecount, 1);
+		for (c = 0, p = 0; p < planecount; p++)
+			if (memcmp(planes[p]->bits, refplanes[p]->bits, refplanes[p]->linewidth * view.height))
+				c = 1;
+		if (c)
+			selftest_fail("Bitmap view", gen_random, size, "planes differ from a copy");
+		bmp256_free(copy);
+	}
+
+	for (p = 0; p < planecount; p++)
+	{
+		bmp256_free(planes[p]);
+		bmp256_free(refplanes[p]);
+	}
+	bmp256_free(merged);
+	bmp256_free(ref);
+	bmp256_free(bmp);
+}
+
+/* Blit part of a random bitmap into another, of any pair of bpp, and
+** compare it with the same blit done a pixel at a time */
+static void selftest_blit_case(void)
+{
+	static const unsigned bpps[4] = {1, 2, 4, 8};
+	BITMAP256 *src, *dest, *ref;
+	unsigned srcbpp, destbpp, srcx, srcy, destx, desty, width, height, x, y;
+	unsigned long size;
+	clock_t start;
+	int c;
+
+	srcbpp = bpps[selftest_rand() % 4];
+	destbpp = bpps[selftest_rand() % 4];
+	src = bmp256_create(1 + selftest_rand() % 320, 1 + selftest_rand() % 16, srcbpp);
+	dest = bmp256_create(1 + selftest_rand() % 320, 1 + selftest_rand() % 16, destbpp);
+	if (!src || !dest)
+		quit("Not enough memory for the self test!");
+	for (y = 0; y < src->height; y++)
+		for (x = 0; x < src->width; x++)
+			bmp256_putpixel(src, x, y, selftest_rand() & 0xFF);
+	for (y = 0; y < dest->height; y++)
+		for (x = 0; x < dest->width; x++)
+			bmp256_putpixel(dest, x, y, selftest_rand() & 0xFF);
+	ref = bmp256_duplicate(dest);
+	if (!ref)
+		quit("Not enough memory for the self test!");
+
+	/* Tiles are usually blitted whole, at a multiple of 8 pixels */
+	srcx = selftest_rand() % src->width;
+	destx = selftest_rand() % dest->width;
+	if (selftest_rand() & 1)
+	{
+		srcx &= ~7;
+		destx &= ~7;
+	}
+	srcy = selftest_rand() % src->height;
+	desty = selftest_rand() % dest->height;
+	width = 1 + selftest_rand() % (src->width - srcx);
+	if (width > dest->width - destx)
+		width = dest->width - destx;
+	height = 1 + selftest_rand() % (src->height - srcy);
+	if (height > dest->height - desty)
+		height = dest->height - desty;
+	size = (unsigned long)width * height;
+
+	/* The pixel conversions bmp256_blit has always made */
+	start = clock();
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			c = bmp256_getpixel(src, srcx + x, srcy + y);
+			if (srcbpp == 1 && destbpp == 2)
+				c = (c == 1 ? 3 : 0);
+			else if (srcbpp == 1 && (destbpp == 4 || destbpp == 8))
+				c = (c == 1 ? 15 : 0);
+			else if ((srcbpp == 4 || srcbpp == 8) && destbpp == 1)
+				c = (c > 7 ? 1 : 0);
+			else if (srcbpp == 8 && destbpp == 4)
+				c = (c % 16);
+			bmp256_putpixel(ref, destx + x, desty + y, c);
+		}
+	}
+	selftest_time(time_blit_pixel, start, size);
+
+	start = clock();
+	bmp256_blit(src, srcx, srcy, dest, destx, desty, width, height);
+	selftest_time(time_blit, start, size);
+
+	if (memcmp(dest->bits, ref->bits, ref->linewidth * ref->height))
+		selftest_fail("Blit", gen_random, size, "pixels differ from the reference");
+
+	bmp256_free(src);
+	bmp256_free(dest);
+	bmp256_free(ref);
+}
+
+/* Round-trip one input through the PNG deflate and inflate, then inflate
+** it cut short and into too small a buffer */
+static void selftest_deflate_case(int gen, unsigned char *data, unsigned long len, unsigned char *out)
+{
+	unsigned char *comp;
+	unsigned long complen, cut;
+	long outlen;
+	clock_t start;
+
+	start = clock();
+	comp = png256_deflate(data, len, &complen);
+	selftest_time(time_deflate, start, len);
+	if (!comp)
+		quit("Not enough memory for the self test!");
+
+	start = clock();
+	outlen = png256_inflate(comp, complen, out, len);
+	selftest_time(time_inflate, start, len);
+	if (outlen != (long)len || memcmp(out, data, len))
+		selftest_fail("png256_inflate", gen, len, "round trip failed");
+
+	cut = selftest_rand() % complen;
+	if (png256_inflate(comp, cut, out, len) >= 0)
+		selftest_fail("png256_inflate", gen, len, "truncated input accepted");
+	if (len > 1 && png256_inflate(comp, complen, out, len - 1) >= 0)
+		selftest_fail("png256_inflate", gen, len, "output overflow accepted");
+
+	free(comp);
+}
+
+static void selftest_munge_case(void)
+{
+	BITMAP256 *bmp, *out;
+	unsigned char *planar, *ref;
+	unsigned width, height, pwidth, x, y, p;
+	unsigned long size;
+	clock_t start;
+
+	/* VGA pictures and tiles are 4 planes of 8bpp bytes */
+	pwidth = 1 + selftest_rand() % 80;
+	width = pwidth * 4;
+	height = 1 + selftest_rand() % 16;
+	size = (unsigned long)width * height;
+	bmp = bmp256_create(width, height, 8);
+	planar = malloc(size);
+	ref = malloc(size);
+	if (!bmp || !planar || !ref)
+		quit("Not enough memory for the self test!");
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			bmp->lines[y][x] = selftest_rand() & 0xFF;
+
+	/* Pixel x of a row lives in plane x % 4 */
+	start = clock();
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			ref[((x % 4) * height + y) * pwidth + x / 4] = bmp->lines[y][x];
+	selftest_time(time_munge_pixel, start, size);
+
+	start = clock();
+	bmp256_munge_planar(bmp, planar, 4);
+	selftest_time(time_munge, start, size);
+
+	if (memcmp(planar, ref, size))
+		selftest_fail("Mode X munge", gen_random, size, "planes differ from the reference");
+
+	start = clock();
+	for (p = 0; p < 4; p++)
+		for (y = 0; y < height; y++)
+			for (x = 0; x < pwidth; x++)
+				bmp->lines[y][x * 4 + p] = ref[(p * height + y) * pwidth + x];
+	selftest_time(time_demunge_pixel, start, size);
+
+	start = clock();
+	out = bmp256_demunge_planar(planar, pwidth, height, 4);
+	selftest_time(time_demunge, start, size);
+
+	if (!out)
+		quit("Not enough memory for the self test!");
+	for (y = 0; y < height; y++)
+	{
+		if (memcmp(out->lines[y], bmp->lines[y], width))
+		{
+			selftest_fail("Mode X demunge", gen_random, size, "pixels differ from the reference");
+			break;
+		}
+	}
+
+	bmp256_free(bmp);
+	bmp256_free(out);
+	free(planar);
+	free(ref);
+}
+
+static void selftest_rect_case(void)
+{
+	static const unsigned bpps[4] = {1, 2, 4, 8};
+	BITMAP256 *bmp, *ref;
+	BMP256_GETTER get;
+	int x1, y1, x2, y2, x, y, c;
+	unsigned long size;
+	clock_t start;
+
+	bmp = bmp256_create(1 + selftest_rand() % 320, 1 + selftest_rand() % 16, bpps[selftest_rand() % 4]);
+	if (!bmp)
+		quit("Not enough memory for the self test!");
+	for (y = 0; y < bmp->height; y++)
+		for (x = 0; x < bmp->width; x++)
+			bmp256_putpixel(bmp, x, y, selftest_rand() & 0xFF);
+	ref = bmp256_duplicate(bmp);
+	if (!ref)
+		quit("Not enough memory for the self test!");
+
+	/* Let the rectangle hang over the edges now and then */
+	x1 = (int)(selftest_rand() % (bmp->width + 8)) - 4;
+	x2 = x1 + (int)(selftest_rand() % (bmp->width + 8));
+	y1 = (int)(selftest_rand() % (bmp->height + 4)) - 2;
+	y2 = y1 + (int)(selftest_rand() % (bmp->height + 4));
+	c = selftest_rand() & 0xFF;
+	size = (unsigned long)(x2 - x1 + 1) * (y2 - y1 + 1);
+
+	/* bmp256_putpixel ignores the pixels outside the bitmap */
+	start = clock();
+	for (y = y1; y <= y2; y++)
+		for (x = x1; x <= x2; x++)
+			bmp256_putpixel(ref, x, y, c);
+	selftest_time(time_rect_pixel, start, size);
+
+	start = clock();
+	bmp256_rect(bmp, x1, y1, x2, y2, c);
+	selftest_time(time_rect, start, size);
+
+	/* Compare through the row accessor too */
+	get = bmp256_getter(bmp->bpp);
+	for (y = 0; y < bmp->height; y++)
+	{
+		for (x = 0; x < bmp->width; x++)
+		{
+			if (get(bmp->lines[y], x) != bmp256_getpixel(ref, x, y))
+			{
+				selftest_fail("Rectangle", gen_random, size, "pixels differ from the reference");
+				y = bmp->height;
+				break;
+			}
+		}
+	}
+
+	bmp256_free(bmp);
+	bmp256_free(ref);
+}
+
+/* Map random truecolor pixels to the palette, half of them colours that are
+** in it. Those must map to the lowest entry that has them; the rest may land
+** on a slightly worse colour than the search finds, as the table is built for
+** the centre of each cell, but never by more than twice the cell's radius. */
+static void selftest_quantize_case(void)
+{
+	static const int depths[3][2] = {{4, 16}, {8, 32}, {8, 256}};
+	const unsigned char *pal;
+	unsigned char pixels[256 * 4], ref[256], out[256];
+	unsigned count, step, i, j, bpp, colours;
+	long d, bestd[256], gotd;
+	clock_t start;
+
+	i = selftest_rand() % 3;
+	bpp = depths[i][0];
+	colours = depths[i][1];
+	pal = bmp256_palette(bpp);
+	count = 1 + selftest_rand() % 256;
+	step = 3 + selftest_rand() % 2;
+	for (i = 0; i < count; i++)
+	{
+		if (selftest_rand() & 1)
+			memcpy(pixels + i * step, pal + (selftest_rand() % colours) * 4, 3);
+		else
+			for (j = 0; j < 3; j++)
+				pixels[i * step + j] = selftest_rand() & 0xFF;
+	}
+
+	/* Bytes are blue, green and red in both. Time the lookups only, not
+	** building the table the first time round. */
+	if (!bmp256_quantize(pixels, 1, step, out, bpp, colours))
+		quit("Not enough memory for the self test!");
+	start = clock();
+	for (i = 0; i < count; i++)
+	{
+		bestd[i] = LONG_MAX;
+		for (j = 0; j < colours; j++)
+		{
+			d = (long)(pixels[i * step] - pal[j * 4]) * (pixels[i * step] - pal[j * 4]) +
+				(long)(pixels[i * step + 1] - pal[j * 4 + 1]) * (pixels[i * step + 1] - pal[j * 4 + 1]) +
+				(long)(pixels[i * step + 2] - pal[j * 4 + 2]) * (pixels[i * step + 2] - pal[j * 4 + 2]);
+			if (d < bestd[i])
+			{
+				bestd[i] = d;
+				ref[i] = j;
+			}
+		}
+	}
+	selftest_time(time_quantize_search, start, count * 3);
+
+	start = clock();
+	if (!bmp256_quantize(pixels, count, step, out, bpp, colours))
+		quit("Not enough memory for the self test!");
+	selftest_time(time_quantize, start, count * 3);
+
+	for (i = 0; i < count; i++)
+	{
+		j = out[i];
+		gotd = (long)(pixels[i * step] - pal[j * 4]) * (pixels[i * step] - pal[j * 4]) +
+			(long)(pixels[i * step + 1] - pal[j * 4 + 1]) * (pixels[i * step + 1] - pal[j * 4 + 1]) +
+			(long)(pixels[i * step + 2] - pal[j * 4 + 2]) * (pixels[i * step + 2] - pal[j * 4 + 2]);
+		if (j >= colours || (bestd[i] == 0 && j != ref[i]) ||
+				sqrt((double)gotd) > sqrt((double)bestd[i]) + 3 * sqrt(3.0))
+		{
+			selftest_fail("Palette lookup", gen_random, count, "colour too far from the nearest");
+			break;
+		}
+	}
+}
+
+/* Save a random bitmap as an RLE compressed BMP and load it back. Rows mix
+** runs, alternating pairs of pixels and literals of every length, down to
+** the ones too short to be written as literals. Returns 1 if the file came
+** out compressed, which it needn't when RLE would make it bigger. */
+static int selftest_rle_case(char *scratch)
+{
+	BITMAP256 *bmp, *out;
+	BMP256_GETTER get;
+	FILE *f;
+	unsigned char header[34];
+	unsigned x, y, i, n, kind, c1, c2;
+	unsigned long size;
+	int compressed;
+
+	bmp = bmp256_create(1 + selftest_rand() % 80, 1 + selftest_rand() % 8, (selftest_rand() & 1) ? 8 : 4);
+	if (!bmp)
+		quit("Not enough memory for the self test!");
+	size = (unsigned long)bmp->width * bmp->height;
+	for (y = 0; y < bmp->height; y++)
+	{
+		for (x = 0; x < bmp->width; x += n)
+		{
+			kind = selftest_rand() % 4;
+			switch (kind)
+			{
+			case 0:
+				n = 1 + selftest_rand() % 300;
+				break;
+			case 1:
+				n = 2 + selftest_rand() % 40;
+				break;
+			case 2:
+				n = 1 + selftest_rand() % 2;
+				break;
+			default:
+				n = 3 + selftest_rand() % 20;
+				break;
+			}
+			c1 = selftest_rand() & 0xFF;
+			c2 = selftest_rand() & 0xFF;
+			for (i = 0; i < n && x + i < bmp->width; i++)
+			{
+				if (kind >= 2)
+					c1 = selftest_rand() & 0xFF;
+				bmp256_putpixel(bmp, x + i, y, (kind == 1 && (i & 1)) ? c2 : c1);
+			}
+		}
+	}
+
+	bmp256_setcompression(1);
+	if (!bmp256_save(bmp, scratch, 0))
+		quit("Can't write %s for the self test!", scratch);
+	bmp256_setcompression(0);
+
+	/* The compression field of the info header */
+	compressed = 0;
+	f = fopen(scratch, "rb");
+	if (f && fread(header, sizeof(header), 1, f) == 1)
+		compressed = header[30] != 0;
+	if (f)
+		fclose(f);
+
+	out = bmp256_load(scratch);
+	if (!out || out->width != bmp->width || out->height != bmp->height || out->bpp != bmp->bpp)
+	{
+		selftest_fail("RLE bitmap", gen_runs, size, "didn't load back");
+	}
+	else
+	{
+		get = bmp256_getter(bmp->bpp);
+		for (y = 0; y < bmp->height; y++)
+		{
+			for (x = 0; x < bmp->width; x++)
+			{
+				if (get(out->lines[y], x) != get(bmp->lines[y], x))
+				{
+					selftest_fail("RLE bitmap", gen_runs, size, "pixels differ from the original");
+					y = bmp->height;
+					break;
+				}
+			}
+		}
+	}
+
+	bmp256_free(bmp);
+	bmp256_free(out);
+	return compressed;
+}
+
+/* PNG fields are big-endian */
+static unsigned long selftest_get32(const unsigned char *p)
+{
+	return (unsigned long)p[0] << 24 | (unsigned long)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void selftest_put32(unsigned char *p, unsigned long v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Write a PNG chunk, with its CRC worked out a bit at a time */
+static unsigned char *selftest_put_chunk(unsigned char *p, const char *type, const unsigned char *data, unsigned long len)
+{
+	unsigned long crc = 0xFFFFFFFFUL, i;
+	int bit;
+
+	selftest_put32(p, len);
+	memcpy(p + 4, type, 4);
+	memcpy(p + 8, data, len);
+	for (i = 0; i < len + 4; i++)
+	{
+		crc ^= p[4 + i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320UL : 0);
+	}
+	selftest_put32(p + 8 + len, crc ^ 0xFFFFFFFFUL);
+	return p + 12 + len;
+}
+
+static int selftest_paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+
+	if (abs(p - a) <= abs(p - b) && abs(p - a) <= abs(p - c))
+		return a;
+	return (abs(p - b) <= abs(p - c)) ? b : c;
+}
+
+/* Check the pixels of a decoded PNG against the bitmap it was made from */
+static void selftest_png_compare(BITMAP256 *bmp, BITMAP256 *out, unsigned long size, const char *what)
+{
+	BMP256_GETTER get;
+	unsigned x, y;
+
+	if (!out || out->width != bmp->width || out->height != bmp->height || out->bpp != bmp->bpp)
+	{
+		selftest_fail("PNG bitmap", gen_random, size, what);
+		return;
+	}
+	get = bmp256_getter(bmp->bpp);
+	for (y = 0; y < bmp->height; y++)
+	{
+		for (x = 0; x < bmp->width; x++)
+		{
+			if (get(out->lines[y], x) != get(bmp->lines[y], x))
+			{
+				selftest_fail("PNG bitmap", gen_random, size, what);
+				return;
+			}
+		}
+	}
+}
+
+/* Encode a random bitmap as a PNG file and decode it again. The encoder
+** only writes unfiltered rows in one IDAT chunk, so the file is then rebuilt
+** with a random filter on each row and the image data split in two, and
+** decoded once more. Last, a flipped bit in the image data must be caught
+** by the chunk CRC. */
+static void selftest_png_case(void)
+{
+	static const unsigned bpps[4] = {1, 2, 4, 8};
+	BITMAP256 *bmp, *out;
+	unsigned char *png, *idat, *raw, *zdata, *rebuilt, *p, *row, *prior;
+	unsigned long size, len, rowbytes, rawlen, zlen, split, x;
+	unsigned y, kind, c;
+	int a, b, d;
+
+	bmp = bmp256_create(1 + selftest_rand() % 100, 1 + selftest_rand() % 16, bpps[selftest_rand() % 4]);
+	if (!bmp)
+		quit("Not enough memory for the self test!");
+	size = (unsigned long)bmp->width * bmp->height;
+	for (y = 0; y < bmp->height; y++)
+	{
+		kind = selftest_rand() % 3;
+		c = selftest_rand() & 0xFF;
+		for (x = 0; x < bmp->width; x++)
+		{
+			if (kind == 0)
+				c = selftest_rand() & 0xFF;
+			else if (kind == 1 && y)
+				c = bmp256_getpixel(bmp, x, y - 1);
+			bmp256_putpixel(bmp, x, y, c);
+		}
+	}
+
+	png = png256_encode(bmp, &len);
+	if (!png)
+		quit("Not enough memory for the self test!");
+	out = png256_decode(png, len);
+	selftest_png_compare(bmp, out, size, "round trip failed");
+	bmp256_free(out);
+
+	/* Find the image data, which comes after the header and palette */
+	idat = png + 8;
+	while (idat + 12 <= png + len && memcmp(idat + 4, "IDAT", 4))
+		idat += 12 + selftest_get32(idat);
+	if (idat + 12 > png + len)
+	{
+		selftest_fail("PNG bitmap", gen_random, size, "no image data written");
+		free(png);
+		bmp256_free(bmp);
+		return;
+	}
+
+	rowbytes = ((unsigned long)bmp->width * bmp->bpp + 7) / 8;
+	rawlen = (rowbytes + 1) * bmp->height;
+	raw = malloc(rawlen);
+	if (!raw)
+		quit("Not enough memory for the self test!");
+	if (png256_inflate(idat + 8, selftest_get32(idat), raw, rawlen) != (long)rawlen)
+		selftest_fail("PNG bitmap", gen_random, size, "image data doesn't inflate");
+
+	/* Filter from the bottom right, so the bytes each filter refers to are
+	** still unfiltered */
+	for (y = bmp->height; y-- > 0; )
+	{
+		row = raw + y * (rowbytes + 1) + 1;
+		prior = y ? row - (rowbytes + 1) : NULL;
+		row[-1] = selftest_rand() % 5;
+		for (x = rowbytes; x-- > 0; )
+		{
+			a = x ? row[x - 1] : 0;
+			b = prior ? prior[x] : 0;
+			d = (x && prior) ? prior[x - 1] : 0;
+			switch (row[-1])
+			{
+			case 1:
+				row[x] -= a;
+				break;
+			case 2:
+				row[x] -= b;
+				break;
+			case 3:
+				row[x] -= (a + b) / 2;
+				break;
+			case 4:
+				row[x] -= selftest_paeth(a, b, d);
+				break;
+			}
+		}
+	}
+	zdata = png256_deflate(raw, rawlen, &zlen);
+	rebuilt = malloc(len + zlen + 24);
+	if (!zdata || !rebuilt)
+		quit("Not enough memory for the self test!");
+
+	/* Keep everything up to the image data, and the IEND chunk */
+	memcpy(rebuilt, png, idat - png);
+	split = selftest_rand() % (zlen + 1);
+	p = selftest_put_chunk(rebuilt + (idat - png), "IDAT", zdata, split);
+	p = selftest_put_chunk(p, "IDAT", zdata + split, zlen - split);
+	memcpy(p, png + len - 12, 12);
+	p += 12;
+
+	out = png256_decode(rebuilt, p - rebuilt);
+	selftest_png_compare(bmp, out, size, "filtered rows decoded wrongly");
+	bmp256_free(out);
+
+	/* Anywhere from the first IDAT's data to the second's chunk type */
+	x = (idat - png) + 8 + selftest_rand() % (zlen + 8);
+	rebuilt[x] ^= 1 << (selftest_rand() % 8);
+	out = png256_decode(rebuilt, p - rebuilt);
+	if (out)
+		selftest_fail("PNG bitmap", gen_random, size, "corrupt chunk accepted");
+	bmp256_free(out);
+
+	free(png);
+	free(raw);
+	free(zdata);
+	free(rebuilt);
+	bmp256_free(bmp);
+}
+
+/* Print the timers from first to last. If compare is set, each is a faster
+** version of the one before it. */
+static void selftest_report(int first, int last, int compare)
+{
+	int i;
+	double reftime = 0;
+
+	for (i = first; i <= last; i++)
+	{
+		do_output("  %-28s%8.3fs", Timers[i].name, Timers[i].seconds);
+		if (Timers[i].seconds > 0)
+		{
+			do_output("  %8.2f MB/s", Timers[i].bytes / Timers[i].seconds / 1048576.0);
+			if (compare && i > first && reftime > 0)
+				do_output("  (%.2fx)", reftime / Timers[i].seconds);
+		}
+		do_output("\n");
+		reftime = Timers[i].seconds;
+	}
+}
+
+int selftest_run(SwitchStruct *switches)
+{
+	HuffContext *ctx;
+	LZContext *lzctx;
+	unsigned char *data, *comp1, *comp2, *out1, *out2;
+	char scratch[PATH_MAX];
+	unsigned long len;
+	int i, gen, compressed;
+
+	RandState = switches->SelfTestSeed ? switches->SelfTestSeed : 1;
+	Failures = 0;
+
+	/* Huffman codes are at most 64 bits, so the output is at most 8 times as long */
+	data = malloc(SELFTEST_MAXLEN);
+	comp1 = malloc(SELFTEST_MAXLEN * 8 + 16);
+	comp2 = malloc(SELFTEST_MAXLEN * 8 + 16);
+	out1 = malloc(SELFTEST_MAXLEN + 1);
+	out2 = malloc(SELFTEST_MAXLEN + 1);
+	ctx = huff_ctx_create();
+	lzctx = lz_ctx_create();
+	if (!data || !comp1 || !comp2 || !out1 || !out2 || !ctx || !lzctx)
+		quit("Not enough memory for the self test!");
+
+	do_output("Testing Huffman codecs... ");
+	for (i = 0; i < SELFTEST_CASES; i++)
+	{
+		showprogress((i * 100) / SELFTEST_CASES);
+		gen = i % NUM_GENERATORS;
+		len = selftest_length(SELFTEST_MAXLEN);
+		selftest_generate(gen, data, len);
+		selftest_huff_case(ctx, gen, data, len, comp1, comp2, out1, out2);
+	}
+	completemsg();
+
+	do_output("Testing LZ codecs... ");
+	for (i = 0; i < SELFTEST_CASES; i++)
+	{
+		showprogress((i * 100) / SELFTEST_CASES);
+		gen = i % NUM_GENERATORS;
+		len = selftest_length(SELFTEST_MAXLEN);
+		selftest_generate(gen, data, len);
+		selftest_lz_case(lzctx, gen, data, len, comp1, comp2, out1, out2);
+	}
+	/* One long run, whose strings grow far beyond the 128 bytes the
+	** decoders used to be limited to */
+	selftest_generate(gen_constant, data, SELFTEST_MAXLEN);
+	selftest_lz_case(lzctx, gen_constant, data, SELFTEST_MAXLEN, comp1, comp2, out1, out2);
+	completemsg();
+
+	do_output("Testing deflate codec... ");
+	for (i = 0; i < SELFTEST_CASES; i++)
+	{
+		showprogress((i * 100) / SELFTEST_CASES);
+		gen = i % NUM_GENERATORS;
+		len = selftest_length(SELFTEST_MAXLEN);
+		selftest_generate(gen, data, len);
+		selftest_deflate_case(gen, data, len, out1);
+	}
+	completemsg();
+
+	do_output("Testing bitmap planes... ");
+	for (i = 0; i < SELFTEST_CASES; i++)
+	{
+		showprogress((i * 100) / SELFTEST_CASES);
+		selftest_planes_case();
+		selftest_blit_case();
+		selftest_munge_case();
+		selftest_rect_case();
+		selftest_quantize_case();
+	}
+	completemsg();
+
+	/* The bitmaps go through a file in the BMP directory */
+	do_output("Testing RLE bitmaps... ");
+	snprintf(scratch, sizeof (scratch), "%s/modid_selftest.bmp", switches->OutputPath);
+	compressed = 0;
+	for (i = 0; i < SELFTEST_CASES; i++)
+	{
+		showprogress((i * 100) / SELFTEST_CASES);
+		compressed += selftest_rle_case(scratch);
+	}
+	remove(scratch);
+	if (!compressed)
+		selftest_fail("RLE bitmap", gen_runs, 0, "never saved compressed");
+	completemsg();
+
+	do_output("Testing PNG bitmaps... ");
+	for (i = 0; i < SELFTEST_CASES; i++)
+	{
+		showprogress((i * 100) / SELFTEST_CASES);
+		selftest_png_case();
+	}
+	completemsg();
+
+	do_output("\nCodec speeds:\n");
+	selftest_report(time_huff_compress_bitwise, time_huff_compress, 1);
+	selftest_report(time_huff_expand_tree, time_huff_expand, 1);
+	selftest_report(time_lz_compress_file, time_lz_compress, 1);
+	selftest_report(time_lz_decompress_file, time_lz_decompress, 1);
+	selftest_report(time_plane_split_pixel, time_plane_split, 1);
+	selftest_report(time_plane_merge_pixel, time_plane_merge, 1);
+	selftest_report(time_blit_pixel, time_blit, 1);
+	selftest_report(time_munge_pixel, time_munge, 1);
+	selftest_report(time_demunge_pixel, time_demunge, 1);
+	selftest_report(time_rect_pixel, time_rect, 1);
+	selftest_report(time_deflate, time_inflate, 0);
+	selftest_report(time_quantize_search, time_quantize, 1);
+
+	huff_ctx_free(ctx);
+	lz_ctx_free(lzctx);
+	free(data);
+	free(comp1);
+	free(comp2);
+	free(out1);
+	free(out2);
+
+	if (Failures)
+	{
+		setcol_error;
+		do_output("\n%d checks failed (seed %lu).\n", Failures, switches->SelfTestSeed ? switches->SelfTestSeed : 1UL);
+		setcol_normal;
+		return 0;
+	}
+	do_output("\nAll checks passed.\n");
+	return 1;
+}
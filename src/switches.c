@@ -113,10 +113,30 @@ SwitchStruct *getswitches(int argc, char *argv[])
 
 			strncpy(switches.PalettePath, value, PATH_MAX);
 		}
+		else if(stricmp(option, "lutcache") == 0)
+		{
+			if(!value)
+				quit("No directory for palette tables given!");
+
+			strncpy(switches.LutCachePath, value, PATH_MAX - 1);
+		}
+		else if(stricmp(option, "format") == 0)
+		{
+			if(!value)
+				quit("No image format given!");
+			if(stricmp(value, "bmp") && stricmp(value, "png"))
+				quit("Unknown image format '%s'!", value);
+
+			strncpy(switches.ImageExt, stricmp(value, "png") ? "bmp" : "png", sizeof (switches.ImageExt));
+		}
 		else if(strcmp(option, "16color") == 0)
 		{
 			switches.SeparateMask = 1;
 		}
+		else if(stricmp(option, "rle") == 0)
+		{
+			switches.RleBitmaps = 1;
+		}
 		else if(strcmp(option, "igrabsig") == 0)
 		{
 			switches.IgrabSig = 1;
@@ -137,6 +157,19 @@ SwitchStruct *getswitches(int argc, char *argv[])
 		{
 			switches.OptimizedComp = 1;
 		}
+		else if(stricmp(option, "bestdict") == 0)
+		{
+			switches.BestDict = 1;
+		}
+		else if(stricmp(option, "maxcodelen") == 0)
+		{
+			if(!value)
+				quit("No maximum code length given!");
+
+			switches.MaxCodeLen = atoi(value);
+			if(switches.MaxCodeLen < 8 || switches.MaxCodeLen > 64)
+				quit("The maximum code length must be between 8 and 64 bits!");
+		}
 		else if(stricmp(option, "backup") == 0)
 		{
 			switches.Backup = 1;
@@ -145,6 +178,16 @@ SwitchStruct *getswitches(int argc, char *argv[])
 		{
 			switches.Patch = 0;
 		}
+		else if(stricmp(option, "benchmark") == 0)
+		{
+			switches.Benchmark = 1;
+		}
+		else if(stricmp(option, "selftest") == 0)
+		{
+			switches.SelfTest = 1;
+			if(value)
+				switches.SelfTestSeed = strtoul(value, NULL, 0);
+		}
 		else if(stricmp(option, "help") == 0 || stricmp(option, "?") == 0)
 		{
 			showswitches();
@@ -158,10 +201,15 @@ SwitchStruct *getswitches(int argc, char *argv[])
 		}
 	}
 	
+	/* The self test doesn't touch any game files */
+	if(switches.SelfTest)
+		return &switches;
 	if(!switches.Import && !switches.Export)
 		quit("Either -import or -export must be given!");
 	if(strlen(switches.EpisodeDefPath) == 0)
 		quit("The game definition path must be given!");
+	if(switches.MaxCodeLen && switches.Import && !switches.OptimizedComp && !switches.BestDict)
+		quit("-maxcodelen can only be used with -optimizedcomp or -bestdict!");
 	
 	return &switches;
 }
@@ -171,17 +219,25 @@ static void defaultswitches()
 	strncpy(switches.InputPath, ".", PATH_MAX);
 	strncpy(switches.OutputPath, ".", PATH_MAX);
 	strncpy(switches.PalettePath, "", PATH_MAX);
+	strncpy(switches.LutCachePath, "", PATH_MAX);
+	strncpy(switches.ImageExt, "bmp", sizeof (switches.ImageExt));
 	strncpy(switches.EpisodeDefPath, "", PATH_MAX);
 	
 	switches.Backup = 0;
 	switches.Export = 0;
 	switches.Import = 0;
 	switches.SeparateMask = 0;
+	switches.RleBitmaps = 0;
 	switches.IgrabSig = 0;
 	switches.IgrabHuffTrailMode = 0;
 	switches.SparseTiles = 1;
 	switches.OptimizedComp = 0;
+	switches.MaxCodeLen = 0;
+	switches.BestDict = 0;
 	switches.Patch = 1;
+	switches.Benchmark = 0;
+	switches.SelfTest = 0;
+	switches.SelfTestSeed = 0;
 }
 
 /* Switch format: -option="value string" -option -option=value */
@@ -244,14 +300,21 @@ static void showswitches (void)
 			"    -import             [Import game data from BMP files (and more)]\n"
 			"    -gamedir=DIRECTORY  [Game files are in DIRECTORY (defaults to current)]\n"
 			"    -bmpdir=DIRECTORY   [BMP files are in DIRECTORY (defaults to current)]\n"
-			"    -palette=FILEPATH   [Set BMP palette for export (defaults to EGA colors)]\n"
+			"    -palette=FILEPATH   [Set BMP palette for export and truecolor import]\n"
+			"    -lutcache=DIRECTORY [Keep truecolor import tables in DIRECTORY]\n"
 			"    -16color            [Masked BMP files have 16 colors, separate masks]\n"
+			"    -rle                [Export RLE-compressed BMP files]\n"
+			"    -format=FORMAT      [Export and import bmp (default) or png files]\n"
 			"    -igrabsig           [Add !ID! signature before certains chunks as in IGRAB]\n"
 			"    -igrabhufftrail1    [Add trailing byte in compression as in IGRAB]\n"
 			"    -igrabhufftrail2    [Add trailing byte in <60000 chunk compression as in IGRAB]\n"
 			"    -nosparse           [Export sparse Keen 4-6 tiles as black tiles, import as-is]\n"
 			"    -optimizedcomp      [Create optimized Huffman dictionary while importing]\n"
+			"    -bestdict           [Import with whichever Huffman dictionary is smallest]\n"
+			"    -maxcodelen=BITS    [Limit optimized Huffman codes to BITS bits (8-64)]\n"
 			"    -backup             [Create backups of changed files]\n"
+			"    -benchmark          [Time the decompressors against reference versions]\n"
+			"    -selftest[=SEED]    [Check and time the compression routines, then exit]\n"
 			"    -debug              [Show debug information for developers and testers]\n"
 			"    -help               [Shows the valid options for ModId]\n"
 			"\n"
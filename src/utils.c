@@ -173,6 +173,18 @@ void showprogress(float param)
 	setcol_normal;
 }
 
+/* Print one benchmark timing, with its speed relative to the reference timing if given */
+void benchmark_line(const char *name, double seconds, unsigned long bytes, double reftime)
+{
+	do_output("  %-14s%8.3fs", name, seconds);
+	if (seconds > 0) {
+		do_output("  %8.2f MB/s", bytes * (double) BENCHMARK_PASSES / seconds / 1048576.0);
+		if (reftime > 0)
+			do_output("  (%.2fx)", reftime / seconds);
+	}
+	do_output("\n");
+}
+
 char *strlwr(char *str)
 {
 	unsigned char *p = (unsigned char  *)str;